@@ -24,8 +24,59 @@
 #pragma config LVP = ON         // Low-Voltage Programming Enable (Low-voltage programming enabled)
 
 
-#define BUF_SIZE 64
-#define LAYER_SIZE 8
+//核心频率, 其余定时都由它推出; 换频率不影响刷新率和动画速度
+#ifndef _XTAL_FREQ
+#define _XTAL_FREQ 32000000 //内部 8MHz 经 4x PLL; 也可为 16000000, 8000000 或 4000000
+#endif
+
+#if _XTAL_FREQ == 32000000
+#define OSCCON_INIT 0b11110000 //IRCF=8MHz, SCS=00: 按配置字用内部振荡器并经过 PLL
+#elif _XTAL_FREQ == 16000000
+#define OSCCON_INIT 0b01111010 //SCS=1x 直接用内部振荡器, 不经过 PLL
+#elif _XTAL_FREQ == 8000000
+#define OSCCON_INIT 0b01110010
+#elif _XTAL_FREQ == 4000000
+#define OSCCON_INIT 0b01101011
+#else
+#error "_XTAL_FREQ must be 4, 8, 16 or 32 MHz"
+#endif
+
+#define CLOCK_SCALE (_XTAL_FREQ / 4000000)  //相对最初 4MHz 的倍数
+#define US_CYCLES(us) ((us) * CLOCK_SCALE) //微秒换算成指令周期 (Timer1 计数)
+#define TMR0_POSTSCALE CLOCK_SCALE          //Timer0 已是 1:256 预分频, 再在软件里分频, timer0 节拍保持 15.26Hz
+
+#ifndef CUBE_SIZE
+#define CUBE_SIZE 8 //每边 LED 数: 4, 8 或 16
+#endif
+
+#if CUBE_SIZE == 4
+#define LAYER_BITS 2
+#elif CUBE_SIZE == 8
+#define LAYER_BITS 3
+#elif CUBE_SIZE == 16
+#define LAYER_BITS 4
+#else
+#error "CUBE_SIZE must be 4, 8 or 16"
+#endif
+
+#define ROW_BYTES ((CUBE_SIZE + 7) / 8)    //一行(x 方向)占用的字节数
+#define ROW_NUM (CUBE_SIZE * CUBE_SIZE)     //行号为 z*CUBE_SIZE+y
+#define BUF_SIZE (ROW_NUM * ROW_BYTES)
+#define LAYER_SIZE (CUBE_SIZE * ROW_BYTES) //每层移入的字节数
+#define LAYER_MASK (((1 << LAYER_BITS) - 1) << 4) //层选从 RC4 开始
+#define ROW_FULL ((row_t)((1UL << CUBE_SIZE) - 1))
+
+#if CUBE_SIZE > 8
+//16x16x16: 每层移入 32 字节, 每路 PORTA 数据线收到 32 位, 即串四片 595; 每行先移 x=0..7 的字节
+//缓冲区已占 512 字节, 不再放合成层和过渡缓冲
+typedef uint16_t row_t;
+typedef uint16_t buf_idx_t;
+#define COMPOSE_ENABLE 0
+#else
+typedef uint8_t row_t;
+typedef uint8_t buf_idx_t;
+#define COMPOSE_ENABLE 1
+#endif
 
 #define set_oe_close() { PORTCbits.RC2 = 1; }
 #define set_oe_open() { PORTCbits.RC2 = 0; }
@@ -34,73 +85,865 @@
 #define set_shcp_low() { PORTCbits.RC0 = 0; }
 #define set_shcp_high() { PORTCbits.RC0 = 1; }
 
+#define set_ccpr1(v) { CCPR1H = (uint16_t)(v) >> 8; CCPR1L = (uint8_t)(v); }
+#define scan_wait(from, cycles) { while ((uint16_t)(read_tmr1() - (from)) < (cycles)); }
+
 #define led_up 0
 #define led_down 1
 
+#define SURFACE_NUM 3 //合成层数, 每层占用 BUF_SIZE 字节 RAM
+
+#define blend_or 0   //点亮下层或本层任一亮的点
+#define blend_and 1  //只保留两者都亮的点
+#define blend_xor 2  //两者恰有一个亮的点
+#define blend_mask 3 //本层亮的点把下层遮掉
+
+#define trans_cut 0
+#define trans_wipe_x 1
+#define trans_wipe_y 2
+#define trans_wipe_z 3
+#define trans_dissolve 4
+
+#define TRANS_TICKS CUBE_SIZE //过渡持续的 timer0 次数
+#define TRANS_DISSOLVE_STEP (ROW_NUM * CUBE_SIZE / TRANS_TICKS) //每次切换的体素数
+
+#if CUBE_SIZE == 4
+#define TRANS_LFSR_BITS 6 //x^6 + x^5 + 1
+#define TRANS_LFSR_TAP 1
+#else
+#define TRANS_LFSR_BITS 9 //x^9 + x^5 + 1
+#define TRANS_LFSR_TAP 4
+#endif
+
+#define sync_none 0
+#define sync_master 1 //广播节拍和播放位置
+#define sync_slave 2  //不用自己的 Timer0, 跟随主机节拍
+
+#ifndef SYNC_ROLE
+#define SYNC_ROLE sync_none
+#endif
+#define SYNC_ADDR 0x30      //从机自身的 I2C 地址, 主机发往广播地址 0
+#define SYNC_FRAME_DATA 0   //为 1 时主机在节拍后附带整帧画面
+#define SYNC_I2C_BAUD (_XTAL_FREQ / 4 / 100000 - 1) //Fosc/(4*(SSPADD+1)) = 100kHz
+//主机写入包里的时间差到从机读到这个字节: 8 位加应答, 再加上从机进中断. 常数部分由 scansim 主从对跑量出
+#define SYNC_LAG_CYCLES (9 * (SYNC_I2C_BAUD + 1) + 100)
+
+#define sync_cmd_tick 0xA5
+#define sync_idle 0  //主机 sync_state
+#define sync_start 1
+#define sync_data 2
+#define sync_stop 3
+#define sync_ready 4 //包已备好, 等换层时发出
+#define SYNC_HDR_SIZE 6
+#if SYNC_FRAME_DATA
+#define SYNC_PKT_SIZE (SYNC_HDR_SIZE + BUF_SIZE)
+#else
+#define SYNC_PKT_SIZE SYNC_HDR_SIZE
+#endif
+
+//程序化效果每次节拍的指令周期预算: scansim -c 在 4/8/16 上量出的耗时约 1.5 倍,
+//高度场按列数 (CUBE_SIZE^2) 缩放, plasma 按体素数 (CUBE_SIZE^3) 缩放.
+//show_cycles 由 16 位 Timer1 量出, 预算超过 65535 的效果不放进 playlist
+#define FX_WAVE_BUDGET (64UL * CUBE_SIZE * CUBE_SIZE)
+#define FX_RIPPLE_BUDGET (72UL * CUBE_SIZE * CUBE_SIZE)
+#define FX_PLASMA_BUDGET (24UL * CUBE_SIZE * CUBE_SIZE * CUBE_SIZE + 1024)
+#define FX_FITS(budget) ((budget) <= 65535)
+
+//逐层扫描时序, 按微秒给出, 换算成 Timer1 计数 (指令周期)
+//换层顺序: 关 OE 消隐 -> 等 SCAN_BLANK_CYCLES -> 换层 -> 等 SCAN_SETTLE_CYCLES
+//-> 锁存 -> 等 SCAN_LATCH_CYCLES -> 开 OE. 上一层的余辉或层选管未关断会造成鬼影,
+//加大 BLANK/SETTLE 可消除, 代价是亮度 (点亮时间占比) 下降
+#define SCAN_BLANK_CYCLES US_CYCLES(8)   //关 OE 后等待驱动输出关断
+#define SCAN_SETTLE_CYCLES US_CYCLES(16) //换层后等待层选管稳定
+#define SCAN_LATCH_CYCLES US_CYCLES(0)   //锁存后到开 OE
+#define SCAN_LATCH_FIRST 0   //为 1 时先锁存再换层 (适合层选管关断慢而列驱动快的板子)
+#ifndef SCAN_INTERLEAVE
+#define SCAN_INTERLEAVE 1    //按位反序换层 (0,4,2,6,1,5,3,7), 相邻两层不连续点亮, 闪烁不易察觉
+#endif
+
+//预渲染帧队列: 主循环提前渲染若干帧, timer0 只取帧, 扫描改由 CCP1 比较中断完成
+//每帧占 BUF_SIZE 字节 RAM, 另有一帧正在显示; 0 为不用队列, 仍在主循环扫描
+//多块同步时节拍和播放位置由主机给出, 不能提前渲染, 默认不用队列
+#ifndef RENDER_DEPTH
+#if COMPOSE_ENABLE && SYNC_ROLE == sync_none
+#define RENDER_DEPTH 2
+#else
+#define RENDER_DEPTH 0
+#endif
+#endif
+#define RENDER_SLOTS (RENDER_DEPTH + 1)
+#define render_next(c) ((c) + 1 == 2 * RENDER_SLOTS ? 0 : (c) + 1) //计数在 2*RENDER_SLOTS 处回绕, 空和满可区分
+
+//换层代码本身的耗时, 按指令周期给出, 不随主频变化; 由 scansim 量出, 见它报告的
+//cycles/byte, ccp1 to shifted 和 layer end to open
+#define SCAN_WAKE_CYCLES 64     //CCP1 匹配到开始移位: 进中断, isr() 和 display() 的开头. 平均约 50,
+                                //正在处理别的中断时更晚, 晚了的由下面的补回吸收
+#define SCAN_BYTE_CYCLES 14     //每移出一个字节
+#define SCAN_SWITCH_CYCLES 96   //关 OE 到开 OE 之间, 消隐等待之外的指令
+#define SCAN_SHIFT_CYCLES (SCAN_WAKE_CYCLES + LAYER_SIZE * SCAN_BYTE_CYCLES) //中断方式下提前唤醒, 留给移入下一层数据
+#define SCAN_GAP_CYCLES (SCAN_BLANK_CYCLES + SCAN_SETTLE_CYCLES + SCAN_LATCH_CYCLES + SCAN_SWITCH_CYCLES)
+
+//换层按层周期 (点亮时间加上面的开销) 排定, 周期按微秒给出, 换主频后刷新率不变.
+//自适应层周期: 主循环的渲染跟不上 timer0 时加长, 换层少了, 省下的中断时间给动画;
+//跟得上时缩短, 提高刷新率. 只看渲染是否赶上节拍, 不看主循环忙闲, 各主频下结果相同.
+//上限保证整帧刷新率不低于 SCAN_MIN_REFRESH
+#ifndef SCAN_ADAPT
+#define SCAN_ADAPT (RENDER_DEPTH > 0) //主循环扫描时动画在中断里, 加长层周期省不出时间
+#endif
+#define SCAN_MIN_REFRESH 100             //Hz
+#define SCAN_ON_MIN (SCAN_SHIFT_CYCLES + US_CYCLES(100)) //最短点亮时间, 移入下一层之外至少亮 100us
+#define SCAN_SLOT_MIN (SCAN_ON_MIN + SCAN_GAP_CYCLES)
+#define SCAN_PERIOD_MAX US_CYCLES(1000000 / SCAN_MIN_REFRESH / CUBE_SIZE)
+#if US_CYCLES(500) < SCAN_SLOT_MIN
+#define SCAN_PERIOD_MIN SCAN_SLOT_MIN
+#else
+#define SCAN_PERIOD_MIN US_CYCLES(500)
+#endif
+#define SCAN_PERIOD_STEP US_CYCLES(50)   //每次 timer0 调整的幅度
+//层周期 (自适应时为初值); 层数多时 800us 会让整帧低于 SCAN_MIN_REFRESH, 这时取 SCAN_PERIOD_MAX
+#if US_CYCLES(800) > SCAN_PERIOD_MAX
+#define SCAN_PERIOD_CYCLES SCAN_PERIOD_MAX
+#else
+#define SCAN_PERIOD_CYCLES US_CYCLES(800)
+#endif
+//渲染等拖过换层时刻后, 之后各层只亮 SCAN_ON_MIN 补回; 拖延超过这么多指令周期 (比最重的一次
+//渲染长) 就放过, 从当前时刻重排. 与 Timer1 之差按 int16_t 比较, 不能超过 32767
+#define SCAN_LATE_MAX 30000
+
+#define FAST_TICK_PR2 249 //Fosc/4/预分频/(PR2+1)/后分频 = 250Hz, 约为 timer0 的 16 倍
+#define FAST_TICK_DIV (_XTAL_FREQ / 4 / 250 / (FAST_TICK_PR2 + 1)) //预分频 x 后分频
+#if FAST_TICK_DIV % 64 == 0
+#define T2CON_INIT ((FAST_TICK_DIV / 64 - 1) << 3 | 0b00000111) //1:64
+#else
+#define T2CON_INIT ((FAST_TICK_DIV / 16 - 1) << 3 | 0b00000110) //1:16
+#endif
+
+#ifndef UART_ENABLE
+#define UART_ENABLE (CUBE_SIZE <= 8) //RX 在 RC7, 16x16x16 时 RC7 用作层选
+#endif
+#define UART_BAUD 38400
+#define UART_BAUD_BRG ((_XTAL_FREQ / 4 + UART_BAUD / 2) / UART_BAUD - 1) //BRG16=1, BRGH=1: Fosc/(4*(n+1))
+
+#define BAR_ENABLE UART_ENABLE
+#define BAR_PKT_SIZE (ROW_NUM / 2) //每柱高度 4 位, 两柱一个字节
+#define BAR_TIMEOUT 45             //最后一包之后保持柱状图的 timer0 次数
+#define bar_sync 0xB0              //包头, 低 4 位为平滑方式
+#define bar_direct 0               //直接显示新高度
+#define bar_decay 1                //升高立即显示, 降低时缓慢回落
+#define bar_smooth 2               //每步向目标靠近 1/4
+
+//实时预览: 把正在显示的帧的变化从 TX (RB6) 发回主机, 见 tools/cubeview.c (CUBE_SIZE 不是 8 时加 -s)
+//包格式: 包头, 序号, 若干 (字节序号, 数据), preview_end, 之前各字节的异或
+#ifndef PREVIEW_ENABLE
+#define PREVIEW_ENABLE 0
+#endif
+#define PREVIEW_INTERVAL 2       //每几次 timer0 开始一包, 限制占用的带宽
+#define PREVIEW_KEY 16           //每几包发一次整帧, 中途接上的主机也能同步
+#define PREVIEW_SCAN 4           //每次调用最多比较的字节数, 保证调用很短
+#define PREVIEW_POLL_CYCLES 150  //本层点亮时间剩余不足时不再发送
+#define preview_sync 0xD0        //包头, 最低位为 1 表示整帧
+#define preview_end 0xFF         //出现在字节序号位置表示数据结束
+
+//按键接在 RB0..RB3 与地之间, 用内部上拉; 电平变化中断唤醒, Timer2 消抖
+#ifndef BTN_ENABLE
+#define BTN_ENABLE 1
+#endif
+#define BTN_MASK 0b00001111
+#define BTN_DEBOUNCE_TICKS 5 //最后一次跳变后等几个快节拍 (约 20ms) 再读
+#define BTN_QUEUE_SIZE 8     //2 的幂
+#define btn_next 0           //RB0: 下一段
+#define btn_prev 1           //RB1: 上一段
+#define btn_pause 2          //RB2: 暂停/继续
+#define btn_bright 3         //RB3: 切换亮度
+#define BRIGHT_LEVELS 4
+
+#define axis_x 0
+#define axis_y 1
+#define axis_z 2
+
+//快节拍效果: 每 speed 个 Timer2 节拍执行一次 step(density)
+typedef struct {
+    void (*step)(uint8_t density);
+    uint8_t density; //每个新生位置点亮的概率, /256
+    uint8_t speed;
+} fast_fx_t;
+
+#define SYM_X 0b00000001 //x 镜像对称, 每行只存 x<4 的 4 位
+#define SYM_Y 0b00000010 //y 镜像对称, 只存 y<4 的行
+#define SYM_Z 0b00000100 //z 镜像对称, 只存 z<4 的层
+#define SYM_REVERSE 0b00001000 //帧倒序播放
+
+typedef struct {
+    uint8_t sym;
+    uint8_t frames;
+    const uint8_t *hold; //每帧持续的 timer0 次数
+    const uint8_t *data;
+} sym_anim_t;
+
+//去重后的帧表: seq 按播放顺序给出帧号, 每帧先是 ROW_NUM/8 字节的行掩码,
+//掩码为 1 的行才保存数据, 其余行全暗
+typedef struct {
+    uint8_t steps;
+    const uint8_t *seq;
+    const uint8_t *hold;    //每步持续的 timer0 次数
+    const uint16_t *offset; //每个不同帧在 data 中的起点
+    const uint8_t *data;
+} packed_anim_t;
+
+//完整的 BUF_SIZE 字节帧, display() 直接从程序存储器读出, 不拷贝到 RAM
+typedef struct {
+    uint8_t frames;
+    const uint8_t *hold;
+    const uint8_t *data;
+} flash_anim_t;
+
 uint8_t display_buffer[BUF_SIZE];
-uint8_t layer_idx;
+uint8_t layer_idx; //下一个要点亮的层
+uint8_t scan_slot; //layer_idx 在换层顺序中的位置
+
+uint8_t *draw_buffer;             //choose_led/choose_line 写入的目标
+const uint8_t *scan_src;          //display() 移位输出的来源, display_buffer 或闪存中的帧
+const uint8_t *flash_frame;       //本次节拍 show 给出的闪存帧, 0 表示画在 draw_buffer 里
 
+#if RENDER_DEPTH
+const uint8_t *frame_src;         //present_frame 给出的最新一帧, 不一定正在显示
+uint8_t render_buf[RENDER_SLOTS][BUF_SIZE];
+const uint8_t *render_ring[RENDER_SLOTS]; //render_buf 中的帧或闪存中的帧
+uint8_t render_fast[RENDER_SLOTS];        //该帧的 show 登记了快节拍效果
+volatile uint8_t render_head;     //下一个要取的帧, 只由 timer0 改写 (实时模式下由主循环改写)
+volatile uint8_t render_tail;     //下一个要放的帧, 只由主循环改写
+volatile uint8_t render_live;     //为 1 时不再预渲染, 主循环按节拍实时画快节拍效果
+volatile uint8_t render_clock;    //实时模式下 timer0 的次数
+volatile uint8_t fast_clock;      //实时模式下快节拍的次数
+uint8_t render_seen;
+uint8_t fast_seen;
+uint8_t render_wait;              //已放入快节拍帧, 等它被取出再转入实时模式
+uint8_t render_fill;              //上一次取帧时队列中的帧数
+uint16_t render_underrun;         //timer0 时队列为空的次数
+uint16_t render_cycles;           //上一帧的渲染耗时 (含被中断占用)
+#define RAM_RENDER (BUF_SIZE * RENDER_SLOTS + RENDER_SLOTS * 3 + 15)
+#else
+#define frame_src scan_src
+#define RAM_RENDER 0
+#endif
 
+#if COMPOSE_ENABLE
+uint8_t surface[SURFACE_NUM][BUF_SIZE];
+uint8_t surface_blend[SURFACE_NUM];
+uint8_t surface_used;            //本段 show 用到的层数, 只合成这几层
+uint8_t dirty_rows[ROW_NUM / 8]; //每位对应一行, 上一次合成后被改写过
+uint8_t compose_rows;            //上一次合成实际处理的行数
+
+uint8_t trans_type;
+uint8_t trans_step;
+uint8_t trans_from[BUF_SIZE]; //过渡开始时的画面
+uint8_t trans_mask[BUF_SIZE]; //随机溶解: 为 1 的位已换成新画面
+uint16_t trans_lfsr;
+
+#define mark_dirty(row) { dirty_rows[(row) >> 3] |= (1 << ((row) & 7)); }
+#define mark_dirty_all() { memset(dirty_rows, 0b11111111, sizeof(dirty_rows)); }
+#define RAM_COMPOSE (BUF_SIZE * (SURFACE_NUM + 3) + ROW_NUM / 8 + SURFACE_NUM + 6) //含 display_buffer
+#else
+#define mark_dirty(row)
+#define mark_dirty_all()
+#define RAM_COMPOSE BUF_SIZE
+#endif
+
+uint8_t tmr0_post; //Timer0 溢出次数, 到 TMR0_POSTSCALE 才算一次 timer0
+uint8_t play_idx;  //当前播放的 playlist 项
+uint8_t play_tick; //该项已播放的 timer0 次数
+uint8_t show_start; //本次是该项的第一拍, show 的 static 状态从头开始
+uint16_t show_cycles;     //上一次 show 用去的指令周期 (Timer1 计数, 不含中断)
+uint16_t fast_cycles;     //上一次快节拍效果用去的指令周期
+uint8_t fast_steps;       //快节拍效果执行的次数, 与 fast_cycles 一起看
+volatile uint16_t isr_cycles; //中断累计占用的指令周期, 从上面两项中扣除
+const fast_fx_t *fast_fx; //当前 show 登记的快节拍效果, 0 为没有
+uint8_t fast_kick;        //为 1 时下一个快节拍立即执行, 不等 speed
+uint16_t fx_rand_state = 1;
+uint8_t show_over_budget; //超出 playlist 中 budget 的次数
+uint16_t scan_on_start;    //当前层开 OE 时的 Timer1 计数
+uint16_t scan_due;         //按层周期排定的本层结束 (开始消隐) 时刻
+uint16_t scan_end;         //本层实际结束的时刻, 落后时晚于 scan_due
+uint32_t scan_on_sum;      //本帧累计点亮时间 (含中断占用)
+uint32_t scan_blank_sum;   //本帧累计消隐时间
+uint32_t scan_on_frame;    //上一整帧的点亮时间, 与 scan_blank_frame 之比即亮度占比
+uint32_t scan_blank_frame;
+#if SCAN_ADAPT
+uint16_t scan_period = SCAN_PERIOD_CYCLES; //当前层周期, 在 SCAN_PERIOD_MIN 和 SCAN_PERIOD_MAX 之间
+#else
+#define scan_period SCAN_PERIOD_CYCLES
+#endif
+
+#if SYNC_ROLE != sync_none
+uint8_t sync_pkt[SYNC_HDR_SIZE]; //cmd, play_idx, play_tick, scan_slot, 发出时距该层在网格上开始消隐的周期数 (低, 高)
+uint8_t sync_pos;      //收/发到第几个字节
+uint8_t sync_state;    //主机 I2C 发送状态
+uint8_t sync_overrun;  //主机: 上一包未发完又到节拍的次数
+uint8_t sync_nack;     //主机: 无从机应答的次数
+int8_t sync_skew;      //从机: 收到节拍时本机比主机超前的层数, 负数为落后
+uint8_t sync_skew_max; //sync_skew 的最大绝对值
+uint8_t sync_resync;   //从机: 播放位置与主机不一致而被纠正的次数
+uint8_t sync_bad;      //从机: 内容越界而丢掉的包
+volatile uint8_t sync_next; //从机: 收到的扫描位置, 由 display() 在换层时套用; 0xFF 为没有
+volatile uint16_t sync_at;  //从机: 推算的主机网格上 scan_slot 层开始消隐的时刻 (本机 Timer1)
+uint8_t sync_hold;     //从机: 中途跟上主机, 到下一段开头前不亮
+#define RAM_SYNC 18
+#else
+#define RAM_SYNC 0
+#endif
+
+#if BAR_ENABLE
+uint8_t bar_rx[BAR_PKT_SIZE];
+uint8_t bar_rx_pos;    //0xFF 表示等待包头
+uint8_t bar_rx_mode;
+uint8_t bar_target[ROW_NUM]; //按 y*CUBE_SIZE+x 保存, 0..CUBE_SIZE
+uint8_t bar_cur[ROW_NUM];    //当前显示的高度, 单位 1/16 层
+uint8_t bar_mode;
+uint8_t bar_ready;     //收到新的一包, 尚未画出
+uint8_t bar_hold;      //大于 0 时 timer0 只画柱状图
+uint8_t bar_packets;
+#if RENDER_DEPTH
+uint8_t bar_flush;     //收到新的一包, 主循环先丢掉队列里之前渲染的帧
+#endif
+#define RAM_BAR (BAR_PKT_SIZE + ROW_NUM * 2 + 6 + (RENDER_DEPTH > 0))
+#else
+#define RAM_BAR 0
+#endif
+
+#if PREVIEW_ENABLE
+uint8_t preview_last[BUF_SIZE]; //主机已收到的画面
+uint8_t preview_state;
+uint8_t preview_pos;   //下一个要比较的字节
+uint8_t preview_val;   //已发出序号, 待发送的数据
+uint8_t preview_sum;
+uint8_t preview_seq;
+uint8_t preview_key;   //本包发送全部字节
+uint8_t preview_due;   //timer0 置位, 到了开始下一包的时间
+uint8_t preview_packets;
+#define RAM_PREVIEW (BUF_SIZE + 8)
+#else
+#define RAM_PREVIEW 0
+#endif
+
+uint8_t scan_bright;   //亮度档位, 0 为最亮
+uint8_t scan_lit_open; //中断扫描: 本层尚未因调暗提前关 OE
+uint8_t play_paused;
+#if BTN_ENABLE
+uint8_t btn_queue[BTN_QUEUE_SIZE]; //按键中断放入, 每帧开始时取出
+volatile uint8_t btn_head;         //只由 button_apply 改写
+volatile uint8_t btn_tail;         //只由 button_sample 改写
+uint8_t btn_state;                 //消抖后按下的键, 位 i 对应 RBi
+uint8_t btn_debounce;              //大于 0 时正在等待消抖
+uint8_t btn_dropped;               //队列满而丢掉的按键
+#define RAM_BTN (BTN_QUEUE_SIZE + 5)
+#else
+#define RAM_BTN 0
+#endif
+
+#define RAM_STATE 76 //扫描, 播放位置, 计时等零散变量和各 show 的 static 状态
+#define RAM_STACK 64 //局部变量, 按最深的调用链 (主循环 + 中断) 估计
+#define RAM_USED (RAM_COMPOSE + RAM_RENDER + RAM_SYNC + RAM_BAR + RAM_PREVIEW + RAM_BTN + RAM_STATE)
+
+#if RAM_USED > 1024 - RAM_STACK //PIC16F1786 共 1024 字节
+#error "buffers exceed the RAM budget for this configuration"
+#endif
+
+#if RENDER_DEPTH && SYNC_ROLE != sync_none
+#error "render-ahead queue cannot follow sync ticks, set RENDER_DEPTH to 0"
+#endif
+
+#if SCAN_ADAPT && !RENDER_DEPTH
+#error "adaptive scan needs the render-ahead queue, set SCAN_ADAPT to 0"
+#endif
+
+#if SCAN_SLOT_MIN > SCAN_PERIOD_MAX //换层开销加上最短点亮时间已超过层周期
+#error "CUBE_SIZE layers cannot be scanned at SCAN_MIN_REFRESH at this _XTAL_FREQ"
+#elif SCAN_PERIOD_MIN > SCAN_PERIOD_MAX
+#error "SCAN_MIN_REFRESH is too high for this CUBE_SIZE"
+#endif
+
+#if PREVIEW_ENABLE && (!UART_ENABLE || SYNC_ROLE != sync_none)
+#error "preview needs the EUSART, and its TX pin RB6 is SDA when SYNC_ROLE is set"
+#endif
+
+
+void system_init();
 void select_layer();
 void reset_display();
-void delay();
-void delay_lack();
 void display();
+void scan_adapt(uint8_t behind);
+void scan_arm(uint16_t from, uint16_t cycles);
+
+void timer0();
+void render_frame();
+void render_ahead();
+void render_store(uint8_t slot);
+uint8_t fast_tick();
+void uart_init();
+void uart_isr();
+void preview_poll();
+void button_init();
+void button_sample();
+void button_apply();
+uint16_t read_tmr1();
+uint16_t read_busy(uint16_t *isr);
+
+void sync_init();
+void sync_send();
+void sync_isr();
+void sync_start_send(uint16_t grid);
+
+void select_surface(uint8_t idx);
+void release_surfaces();
+void present_frame();
+void compose_display();
+void start_transition(uint8_t type);
+void step_transition();
 
 void choose_led(uint8_t x, uint8_t y, uint8_t z, uint8_t state);
-void choose_line(uint8_t y, uint8_t z, uint8_t sequence);
+void choose_line(uint8_t y, uint8_t z, row_t sequence);
 
 void op_L(uint8_t start, uint8_t end, uint8_t state);
 void op_O(uint8_t start, uint8_t end, uint8_t state);
 void op_V(uint8_t start, uint8_t end, uint8_t state);
 void op_E(uint8_t start, uint8_t end, uint8_t state);
 void trans_display_love();
+void trans_display_love_wave();
 
 void trans_display_heart();
 void trans_display_circle();
+void op_beat();
 
 void op_cell_start();
 void op_cell_rotate();
 void op_cell_end();
 
-void interrupt timer0() {
-    static uint8_t graph_idx;
-    if (graph_idx < 10)
-        op_cell_start();
-    else if (graph_idx < 20)
-        op_cell_end();
-    else if(graph_idx < 30)
-        op_cell_start();
-    else if (graph_idx < 93)
-        op_cell_rotate();
-    else if (graph_idx < 103)
-        op_cell_end();
-    else if (graph_idx < 113)
-        op_cell_start();
-    else if (graph_idx < 123)
-        op_cell_end();
-    else if (graph_idx < 140)
-        trans_display_heart();
-    else if (graph_idx < 157)
-        trans_display_circle();
-    else if (graph_idx < 221)
-        trans_display_love();
-    else if (graph_idx < 238)
-        trans_display_circle();
-    else if (graph_idx < 255)
-        trans_display_heart();
-    else;
+void op_shell();
+
+void fx_height_rows(uint8_t y, const uint8_t *h);
+void fx_wave();
+void fx_ripple();
+void fx_plasma();
+
+uint8_t fx_rand();
+void shift_buffer(uint8_t axis, uint8_t up);
+void fx_rain_step(uint8_t density);
+void fx_star_step(uint8_t density);
+void fx_sparkle_step(uint8_t density);
+void fx_rain();
+void fx_starfield();
+void fx_sparkle();
+
+void fx_bars_step(uint8_t density);
+void fx_bars();
+#if BAR_ENABLE
+extern const fast_fx_t fast_bars;
+#endif
+
+void draw_sym_frame(const sym_anim_t *anim, uint8_t frame);
+void play_sym_anim(const sym_anim_t *anim, uint8_t *frame, uint8_t *tick);
+void draw_packed_frame(const packed_anim_t *anim, uint8_t frame);
+void play_packed_anim(const packed_anim_t *anim, uint8_t *step, uint8_t *tick);
+void play_flash_anim(const flash_anim_t *anim, uint8_t *frame, uint8_t *tick);
+
+typedef struct {
+    void (*show)();
+    uint8_t ticks; //持续的 timer0 次数
+    uint8_t trans; //进入本段时的过渡方式
+    uint16_t budget; //每次节拍 show 允许的指令周期, 0 为不检查
+} play_entry_t;
+
+#if CUBE_SIZE == 8
+const play_entry_t playlist[] = {
+    {op_cell_start, 10, trans_dissolve},
+    {op_cell_end, 10, trans_cut},
+    {op_cell_start, 10, trans_cut},
+    {op_cell_rotate, 63, trans_cut},
+    {op_cell_end, 10, trans_cut},
+    {op_cell_start, 10, trans_cut},
+    {op_cell_end, 10, trans_cut},
+    {trans_display_heart, 17, trans_dissolve},
+    {trans_display_circle, 17, trans_cut},
+    {trans_display_love, 64, trans_wipe_y},
+    {trans_display_circle, 17, trans_wipe_z},
+    {trans_display_heart, 17, trans_cut},
+    {op_beat, 16, trans_cut},
+    {fx_wave, 64, trans_dissolve, FX_WAVE_BUDGET},
+    {trans_display_love_wave, 64, trans_cut},
+    {fx_ripple, 64, trans_wipe_x, FX_RIPPLE_BUDGET},
+    {fx_plasma, 64, trans_dissolve, FX_PLASMA_BUDGET},
+    {fx_rain, 64, trans_wipe_z},
+    {fx_starfield, 64, trans_dissolve},
+    {fx_sparkle, 32, trans_cut},
+};
+#else
+const play_entry_t playlist[] = {
+    {op_shell, CUBE_SIZE * 2, trans_cut},
+    {fx_wave, 64, trans_cut, FX_WAVE_BUDGET},
+    {fx_ripple, 64, trans_cut, FX_RIPPLE_BUDGET},
+#if FX_FITS(FX_PLASMA_BUDGET) //16x16x16 时每拍约 63000 周期, 4MHz 下占满整个节拍
+    {fx_plasma, 64, trans_cut, FX_PLASMA_BUDGET},
+#endif
+    {fx_rain, 64, trans_cut},
+    {fx_starfield, 64, trans_cut},
+    {fx_sparkle, 32, trans_cut},
+};
+#endif
+
+#define PLAY_NUM (sizeof(playlist) / sizeof(playlist[0]))
+
+#if SCAN_INTERLEAVE
+//换层顺序, 即层号按位反序
+const uint8_t scan_order[CUBE_SIZE] = {
+#if CUBE_SIZE == 4
+    0, 2, 1, 3
+#elif CUBE_SIZE == 8
+    0, 4, 2, 6, 1, 5, 3, 7
+#else
+    0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15
+#endif
+};
+#define scan_layer(slot) scan_order[slot]
+#else
+#define scan_layer(slot) (slot)
+#endif
+
+void interrupt isr() {
+    uint16_t start;
+    
+    start = read_tmr1();
+#if RENDER_DEPTH
+    if (CCP1IE && CCP1IF) //扫描最怕延迟, 最先处理
+    {
+        CCP1IF = 0;
+        display();
+    }
+#endif
+    if (TMR0IE && TMR0IF)
+    {
+#if TMR0_POSTSCALE > 1
+        if (++tmr0_post >= TMR0_POSTSCALE)
+        {
+            tmr0_post = 0;
+            timer0();
+        }
+#else
+        timer0();
+#endif
+        TMR0IF = 0;
+    }
+    if (TMR2IE && TMR2IF)
+    {
+#if RENDER_DEPTH
+        if (render_live)
+            ++fast_clock; //快节拍效果由主循环执行
+#else
+        fast_tick();
+#endif
+#if BTN_ENABLE
+        if (btn_debounce && --btn_debounce == 0)
+            button_sample();
+#endif
+        TMR2IF = 0;
+    }
+#if BTN_ENABLE
+    if (IOCIE && IOCIF)
+    {
+        IOCBF &= ~BTN_MASK; //跳变期间不断重新计时, 稳定后再读端口
+        btn_debounce = BTN_DEBOUNCE_TICKS;
+    }
+#endif
+#if UART_ENABLE
+    if (RCIE && RCIF)
+        uart_isr(); //读 RCREG 时自动清除 RCIF
+#endif
+#if SYNC_ROLE != sync_none
+    if (SSPIF)
+    {
+        SSPIF = 0;
+        sync_isr();
+    }
+#endif
+    isr_cycles += read_tmr1() - start;
+}
+
+void timer0() {
+#if PREVIEW_ENABLE
+    static uint8_t preview_tick;
+#endif
+#if RENDER_DEPTH
+    uint8_t slot;
+#endif
+    
+#if PREVIEW_ENABLE
+    if (++preview_tick >= PREVIEW_INTERVAL)
+    {
+        preview_tick = 0;
+        preview_due = 1;
+    }
+#endif
+#if RENDER_DEPTH
+    if (render_live)
+    {
+#if SCAN_ADAPT
+        scan_adapt(render_seen != render_clock); //上一拍还没画出
+#endif
+        ++render_clock;
+        return;
+    }
+    if (render_head == render_tail)
+    {
+        ++render_underrun; //继续显示上一帧
+#if SCAN_ADAPT
+        scan_adapt(1);
+#endif
+        return;
+    }
+    render_fill = (render_tail + 2 * RENDER_SLOTS - render_head) % (2 * RENDER_SLOTS);
+#if SCAN_ADAPT
+    scan_adapt(render_fill < RENDER_DEPTH && !render_wait); //队列没满, 又不是在等转入实时模式
+#endif
+    slot = render_head % RENDER_SLOTS;
+    scan_src = render_ring[slot];
+    if (render_fast[slot])
+        render_live = 1; //队列中之后不会再有帧
+    render_head = render_next(render_head);
+#else
+    render_frame();
+#endif
+}
+
+//播放一个 timer0 节拍: 运行当前 show, 合成后由 present_frame 给出 frame_src
+void render_frame() {
+    uint16_t start, isr_start, isr_end;
     
-    if(++graph_idx >= 255)
-        graph_idx = 0;
+#if BTN_ENABLE
+    if (btn_head != btn_tail)
+        button_apply();
+#endif
+    if (play_paused) //保持上一帧, 快节拍效果也停下
+    {
+        fast_fx = 0;
+        return;
+    }
     
-    TMR0IF = 0;
+    select_surface(0);
+    flash_frame = 0;
+    fast_fx = 0; //快节拍效果由 show 每次重新登记
+    
+#if BAR_ENABLE
+    if (bar_hold) //串口送来柱状图期间暂停 playlist
+    {
+        --bar_hold;
+        release_surfaces();
+        fx_bars();
+        step_transition();
+        present_frame();
+        return;
+    }
+#endif
+    
+    if (play_tick == 0) //display_buffer 中仍是上一段的最后一帧
+    {
+        release_surfaces();
+        start_transition(playlist[play_idx].trans);
+        show_start = 1;
+#if SYNC_ROLE != sync_none
+        fx_rand_state = 1; //各块从段首起用同一个随机序列, 快节拍也从这里重新计起
+        fast_kick = 1;
+        TMR2 = 0;
+#endif
+#if SYNC_ROLE == sync_slave
+        sync_hold = 0;
+#endif
+    }
+    
+    start = read_busy(&isr_start);
+#if SYNC_ROLE == sync_slave
+    if (sync_hold) //show 的状态从段首开始累积, 中途加入的从机画出来会和主机不同
+    {
+        release_surfaces();
+        memset(draw_buffer, 0b11111111, BUF_SIZE);
+        mark_dirty_all();
+    }
+    else
+#endif
+    playlist[play_idx].show();
+    show_cycles = read_busy(&isr_end) - start - (isr_end - isr_start); //不含中断扫描等占用的时间
+    show_start = 0;
+    if (playlist[play_idx].budget && show_cycles > playlist[play_idx].budget)
+        ++show_over_budget;
+    step_transition();
+    present_frame();
+    
+#if SYNC_ROLE == sync_master
+    sync_send();
+#endif
+    
+    if (++play_tick >= playlist[play_idx].ticks)
+    {
+        play_tick = 0;
+        if (++play_idx >= PLAY_NUM)
+            play_idx = 0;
+    }
+}
+
+#if RENDER_DEPTH
+//主循环: 队列未满时预渲染下一帧; 快节拍效果期间按 timer0 和 Timer2 节拍实时渲染
+void render_ahead()
+{
+    uint16_t start;
+    uint8_t slot;
+    
+#if BAR_ENABLE
+    if (bar_flush) //队列里的帧按旧的柱高渲染, 丢掉后下一次 timer0 就换上新的
+    {
+        bar_flush = 0;
+        GIE = 0; //timer0 在中断里改写 render_head
+        render_tail = render_head;
+        GIE = 1;
+        render_wait = 0;
+    }
+#endif
+    if (render_live)
+    {
+        render_wait = 0;
+        if (render_seen != render_clock)
+        {
+            ++render_seen;
+            render_frame();
+        }
+        else if (fast_seen != fast_clock)
+        {
+            ++fast_seen;
+            if (!fast_tick())
+                return;
+        }
+        else
+        {
+            return;
+        }
+        
+        //写入空闲的一格再切换过去, 避免扫描到写了一半的帧
+        slot = render_tail % RENDER_SLOTS;
+        render_store(slot);
+        GIE = 0; //scan_src 是两字节指针, 不能让 CCP1 中断扫描到只换了一半的地址
+        scan_src = render_ring[slot];
+        GIE = 1;
+        render_tail = render_next(render_tail);
+        render_head = render_tail;
+        if (fast_fx == 0) //show 不再登记快节拍效果, 回到预渲染
+        {
+            render_clock = render_seen;
+            render_live = 0;
+        }
+        return;
+    }
+    
+    if (render_wait || (render_tail + 2 * RENDER_SLOTS - render_head) % (2 * RENDER_SLOTS) >= RENDER_DEPTH)
+        return;
+    
+    start = read_tmr1();
+    render_frame();
+    slot = render_tail % RENDER_SLOTS;
+    render_store(slot);
+    render_fast[slot] = (fast_fx != 0);
+    render_wait = render_fast[slot];
+    fast_seen = fast_clock;
+    render_tail = render_next(render_tail); //放入后 timer0 才能取到
+    render_cycles = read_tmr1() - start;
+}
+
+void render_store(uint8_t slot)
+{
+    if (frame_src == display_buffer)
+    {
+        memcpy(render_buf[slot], display_buffer, BUF_SIZE);
+        render_ring[slot] = render_buf[slot];
+    }
+    else
+        render_ring[slot] = frame_src; //闪存帧不拷贝
+}
+#endif
+
+//返回 1 表示执行了一步
+uint8_t fast_tick()
+{
+    static uint8_t fast_count;
+    uint16_t start, isr_start, isr_end;
     
+    if (fast_fx == 0)
+        return 0;
+    if (++fast_count < fast_fx->speed && !fast_kick)
+        return 0;
+    fast_count = 0;
+    fast_kick = 0;
+    
+    start = read_busy(&isr_start);
+    select_surface(0);
+    fast_fx->step(fast_fx->density);
+    present_frame();
+    fast_cycles = read_busy(&isr_end) - start - (isr_end - isr_start);
+    ++fast_steps;
+    return 1;
+}
+
+//同时读出 Timer1 和 isr_cycles, 两次之差相减即为不含中断的耗时
+uint16_t read_busy(uint16_t *isr)
+{
+    uint16_t now;
+    
+#if RENDER_DEPTH
+    GIE = 0; //在主循环里调用, isr_cycles 是两字节
+    now = read_tmr1();
+    *isr = isr_cycles;
+    GIE = 1;
+#else
+    now = read_tmr1(); //在中断里调用
+    *isr = isr_cycles;
+#endif
+    return now;
+}
+
+uint16_t read_tmr1()
+{
+    uint8_t h, l;
+    
+    do
+    {
+        h = TMR1H;
+        l = TMR1L;
+    } while (h != TMR1H); //读低字节时高字节进位则重读
+    return ((uint16_t)h << 8) | l;
 }
 
 void main(void) {
     
-    OSCCON = 0b01101011;
+    system_init();
+
+#if RENDER_DEPTH
+    for (;;) //扫描在 CCP1 中断里, 主循环只渲染
+    {
+        render_ahead();
+#if PREVIEW_ENABLE
+        preview_poll();
+#endif
+    }
+#else
+    for (;;) //扫描循环
+    {
+        display(); //每次只写一层
+    }
+#endif
+}
+
+//时钟, 端口, 定时器和中断; tools/scansim 也从这里开始
+void system_init()
+{
+    OSCCON = OSCCON_INIT;
+#if _XTAL_FREQ == 32000000
+    while (!PLLR); //等 PLL 锁定
+#endif
     
     TRISA = 0;
     PORTA = 0;
@@ -117,24 +960,45 @@ void main(void) {
     PS2 = 1;
     PS1 = 1;
     PS0 = 1;
+    T1CON = 0b00000001; //Timer1: Fosc/4, 1:1, 扫描时序和测量耗时
+    PR2 = FAST_TICK_PR2;
+    T2CON = T2CON_INIT; //Timer2: Fosc/4, 快节拍
     
     reset_display();
+    scan_on_start = read_tmr1();
+    scan_due = scan_on_start + scan_period;
+    scan_end = scan_due;
+    
+#if SYNC_ROLE != sync_none
+    sync_init();
+#endif
+#if UART_ENABLE
+    uart_init();
+#endif
+#if BTN_ENABLE
+    button_init();
+#endif
     
     TMR0IF = 0;
     GIE = 1;
+#if SYNC_ROLE != sync_slave
     TMR0IE = 1;
-
-    
-    for (;;) //扫描循环
-    {
-        display(); //每次只写一层
-    }
+#endif
+    TMR2IF = 0;
+    TMR2IE = 1;
+#if RENDER_DEPTH
+    CCP1CON = 0b00001010; //比较模式, 只产生中断, 不动 RC2
+    set_ccpr1(scan_end - SCAN_SHIFT_CYCLES);
+    CCP1IF = 0;
+    CCP1IE = 1;
+#endif
+    PEIE = 1;
 }
 
 
 void select_layer() {
     uint8_t rc;
-    rc = LATC & 0b10001111;
+    rc = LATC & ~LAYER_MASK;
     rc |= (layer_idx << 4);
     PORTC = rc;
 }
@@ -143,954 +1007,1660 @@ void reset_display() {
     uint8_t i;
     uint8_t start;
     
-    layer_idx = 0;
+    scan_slot = 0;
+    layer_idx = scan_layer(0);
     select_layer();
     
     memset(display_buffer, 0b11111111, BUF_SIZE);
+#if COMPOSE_ENABLE
+    memset(surface, 0b11111111, sizeof(surface));
+    memset(surface_blend, blend_or, SURFACE_NUM);
+    surface_used = 1;
+    mark_dirty_all();
+    draw_buffer = surface[0];
+#else
+    draw_buffer = display_buffer;
+#endif
+    scan_src = display_buffer;
+#if RENDER_DEPTH
+    frame_src = display_buffer;
+#endif
     
-    for (i = 0; i < 8; ++i) {
+    for (i = 0; i < LAYER_SIZE; ++i) {
         set_shcp_low();
         PORTA = 0b11111111;
         set_shcp_high();
     }
 }
 
-void delay() {
-    uint8_t i,j,k;
-    for (i = 0; i < 100; ++i)
-        for (j = 0; j < 100; ++j);
-}
-
-void delay_lack()
-{
-    uint8_t i,j,k;
-    for (i = 0; i < 100; ++i);
-}
-
 void display() {
     uint8_t i;
-    uint8_t start;
-    start = layer_idx * 8;
+    buf_idx_t start;
+    uint16_t blank, now, lit, on;
+    const uint8_t *src;
+#if SYNC_ROLE == sync_slave
+    uint8_t slot;
+    uint16_t at;
+#endif
+    
+#if RENDER_DEPTH
+    if (scan_lit_open) //调暗: 先到的这次中断只关 OE
+    {
+        set_oe_close();
+        scan_lit_open = 0;
+        scan_arm(scan_on_start, scan_end - scan_on_start - SCAN_SHIFT_CYCLES);
+        return;
+    }
+#endif
+    on = scan_end - scan_on_start;
+    lit = on >> scan_bright; //每降一档点亮时间减半, 层周期不变
+    start = layer_idx * LAYER_SIZE;
+#if RENDER_DEPTH
+    src = scan_src; //在 CCP1 中断里, timer0 不会同时换帧
+#else
+    GIE = 0; //timer0 在中断里换帧, 两字节指针要一次读完
+    src = scan_src;
+    GIE = 1;
+#endif
 
     set_stcp_low();
-    for (i = 0; i < 8; ++i) {
+    for (i = 0; i < LAYER_SIZE; ++i) {
         set_shcp_low();
-        PORTA = display_buffer[start++];
+        PORTA = src[start++];
         set_shcp_high();
     }
+    
+    //上一层点亮到 scan_end 才消隐, 移位时间计入点亮时间
+    while ((uint16_t)(read_tmr1() - scan_on_start) < on)
+    {
+        if (lit < on && (uint16_t)(read_tmr1() - scan_on_start) >= lit)
+            set_oe_close(); //调暗: 本层剩余时间不亮
+#if PREVIEW_ENABLE && !RENDER_DEPTH
+        if ((uint16_t)(read_tmr1() - scan_on_start) < on - PREVIEW_POLL_CYCLES)
+            preview_poll(); //只用等待的空闲时间, 不推迟换层
+#endif
+    }
+    
+    blank = read_tmr1();
     set_oe_close();
+    scan_wait(blank, SCAN_BLANK_CYCLES);
+#if SCAN_LATCH_FIRST
+    set_stcp_high();
+    scan_wait(blank, SCAN_BLANK_CYCLES + SCAN_SETTLE_CYCLES);
+    select_layer();
+#else
     select_layer();
+    scan_wait(blank, SCAN_BLANK_CYCLES + SCAN_SETTLE_CYCLES);
     set_stcp_high();
+#endif
+    scan_wait(blank, SCAN_BLANK_CYCLES + SCAN_SETTLE_CYCLES + SCAN_LATCH_CYCLES);
+    now = read_tmr1();
     set_oe_open();
+    blank -= scan_on_start; //上一层点亮的时间
+    if (blank > lit)
+        blank = lit;
     
-    ++layer_idx;
-    if (layer_idx == 8) {
-        layer_idx = 0;
+    //下一次消隐排在 scan_due 再加一个层周期. 中断里的渲染或过长的中断拖过了 scan_due 时,
+    //本层只亮 SCAN_ON_MIN, 之后各层同样缩短, 直到赶回 scan_due; 整帧刷新率不因此降低
+    scan_due += scan_period;
+    if ((int16_t)(scan_due - now) < -SCAN_LATE_MAX || (int16_t)(scan_due - now) > (int16_t)scan_period)
+        scan_due = now + scan_period; //拖延太久, 放过
+    if ((int16_t)(scan_due - now) < SCAN_ON_MIN)
+        scan_end = now + SCAN_ON_MIN;
+    else
+        scan_end = scan_due;
+#if SYNC_ROLE == sync_master
+    if (sync_state == sync_ready) //刚点亮的层在网格上从 scan_due - scan_period 消隐开始
+        sync_start_send(scan_due - scan_period);
+#endif
+#if RENDER_DEPTH
+    on = scan_end - now;
+    lit = on >> scan_bright;
+    if (lit < SCAN_SHIFT_CYCLES) //调暗后很短, 来不及再进一次中断, 就地等到时关 OE
+    {
+        scan_wait(now, lit);
+        set_oe_close();
+        scan_lit_open = 0;
     }
+    else
+        scan_lit_open = (lit < on - SCAN_SHIFT_CYCLES);
+    if (scan_lit_open)
+        scan_arm(now, lit); //先在点亮时间到时关 OE
+    else
+        scan_arm(now, on - SCAN_SHIFT_CYCLES); //下一次换层, 留出移位的时间
+#endif
     
-    delay_lack();
+    scan_on_sum += blank;
+    scan_blank_sum += (uint16_t)(now - scan_on_start) - blank;
+    scan_on_start = now;
+    
+    ++scan_slot;
+    if (scan_slot == CUBE_SIZE) {
+        scan_slot = 0;
+        scan_on_frame = scan_on_sum;
+        scan_blank_frame = scan_blank_sum;
+        scan_on_sum = 0;
+        scan_blank_sum = 0;
+    }
+#if SYNC_ROLE == sync_slave
+    GIE = 0; //I2C 中断随时可能收到新的位置, 只在这里换, 移位和选层总是同一层
+    if (sync_next != 0xFF)
+    {
+        //本机原定在 scan_due 换到 scan_slot 层. 主机网格上 sync_at 消隐后是 sync_next 层,
+        //沿网格找到离 scan_due 最近的一次换层, 改排到那里; 本机正在追赶的话仍然照常追赶
+        at = sync_at + scan_period;
+        slot = sync_next + 1;
+        while ((int16_t)(scan_due - at) > (int16_t)(scan_period / 2))
+        {
+            at += scan_period;
+            ++slot;
+        }
+        while ((int16_t)(at - scan_due) > (int16_t)(scan_period / 2))
+        {
+            at -= scan_period;
+            --slot;
+        }
+        sync_skew = (int8_t)((scan_slot - slot + CUBE_SIZE / 2) & (CUBE_SIZE - 1)) - CUBE_SIZE / 2;
+        i = sync_skew < 0 ? -sync_skew : sync_skew;
+        if (i > sync_skew_max)
+            sync_skew_max = i;
+        scan_slot = slot & (CUBE_SIZE - 1);
+        scan_due = at;
+        if ((int16_t)(scan_due - now) < SCAN_ON_MIN)
+            scan_end = now + SCAN_ON_MIN;
+        else
+            scan_end = scan_due;
+        sync_next = 0xFF;
+    }
+    GIE = 1;
+#endif
+    layer_idx = scan_layer(scan_slot);
 }
 
+#if RENDER_DEPTH
+//CCP1 在 from 之后 cycles 个周期中断. 比较只在相等时触发, 已经过了就直接挂起中断
+void scan_arm(uint16_t from, uint16_t cycles)
+{
+    set_ccpr1(from + cycles);
+    if ((uint16_t)(read_tmr1() - from) >= cycles)
+        CCP1IF = 1;
+}
+#endif
 
-void choose_led(uint8_t x, uint8_t y, uint8_t z, uint8_t state)
+#if SCAN_ADAPT
+//timer0 取帧时调用: 渲染没跟上就加长层周期, 跟上了就缩短
+void scan_adapt(uint8_t behind)
 {
-    if (state == led_up)
-    {
-        display_buffer[z*8+y] &= ~(1 << x);
-    }
-    else if (state == led_down)
+    if (behind)
     {
-        display_buffer[z*8+y] |= (1 << x);
+        if (scan_period < SCAN_PERIOD_MAX - SCAN_PERIOD_STEP)
+            scan_period += SCAN_PERIOD_STEP;
+        else
+            scan_period = SCAN_PERIOD_MAX;
     }
     else
     {
-        //do nothing
+        if (scan_period > SCAN_PERIOD_MIN + SCAN_PERIOD_STEP)
+            scan_period -= SCAN_PERIOD_STEP;
+        else
+            scan_period = SCAN_PERIOD_MIN;
     }
 }
+#endif
+
 
-void choose_line(uint8_t y, uint8_t z, uint8_t sequence)
+void select_surface(uint8_t idx)
 {
-    
-    display_buffer[z*8+y] = sequence;
+#if COMPOSE_ENABLE
+    draw_buffer = surface[idx];
+    while (surface_used <= idx) //新用到的上层从全灭, blend_or 开始
+    {
+        memset(surface[surface_used], 0b11111111, BUF_SIZE);
+        surface_blend[surface_used] = blend_or;
+        ++surface_used;
+        mark_dirty_all();
+    }
+#endif
 }
 
-
-void op_L(uint8_t start, uint8_t end, uint8_t state)
+//换段时停用上层, 下一段 show 不选就只合成底层
+void release_surfaces()
 {
-    uint8_t y,z;
-    if (state == led_up)
+#if COMPOSE_ENABLE
+    if (surface_used > 1)
     {
-        for(y=start;y<=end;y++)
-        {
-            choose_line(y,0,~0b11100000);
-            choose_line(y,1,~0b11100000);
-            choose_line(y,2,~0b11100000);
-            choose_line(y,3,~0b11100000);
-            choose_line(y,4,~0b11100000);
-            choose_line(y,5,~0b11111111);
-            choose_line(y,6,~0b11111111);
-            choose_line(y,7,~0b11111111);
-        }
+        surface_used = 1;
+        mark_dirty_all();
     }
-    else if (state == led_down)
+#endif
+}
+
+void present_frame()
+{
+    if (flash_frame == 0)
     {
-        for(y=start;y<=end;y++)
-        {
-            for(z=0;z<=7;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
+        if (frame_src != display_buffer) //display_buffer 在闪存播放期间没有更新
+            mark_dirty_all();
+        compose_display();
+        frame_src = display_buffer;
+        return;
     }
-    else
+    
+#if COMPOSE_ENABLE
+    if (trans_type != trans_cut) //过渡期间仍要逐行合成, 只能先拷贝
     {
-        //do nothing
+        memcpy(draw_buffer, flash_frame, BUF_SIZE);
+        mark_dirty_all();
+        compose_display();
+        frame_src = display_buffer;
+        return;
     }
+#endif
+    
+    //直接扫描闪存中的帧, 不经过合成层; 之后的 show 会从 draw_buffer 原有内容接着画
+    frame_src = flash_frame;
 }
 
-void op_O(uint8_t start, uint8_t end, uint8_t state)
+void compose_display()
 {
-    uint8_t y,z;
-    if (state == led_up)
-    {
-        for(y=start;y<=end;y++)
-        {
-            choose_line(y,0,~0b00111100);
-            choose_line(y,1,~0b01100110);
-            choose_line(y,2,~0b11000011);
-            choose_line(y,3,~0b11000011);
-            choose_line(y,4,~0b11000011);
-            choose_line(y,5,~0b11000011);
-            choose_line(y,6,~0b01100110);
-            choose_line(y,7,~0b00111100);
-        }
-    }
-    else if (state == led_down)
+#if COMPOSE_ENABLE
+    uint8_t row, mask, s;
+    uint8_t lit, src, keep;
+    uint8_t *dirty;
+    
+    compose_rows = 0;
+    dirty = dirty_rows;
+    mask = 0b00000001;
+    for (row = 0; row < ROW_NUM; ++row)
     {
-        for(y=start;y<=end;y++)
+        if ((*dirty & mask) || trans_type != trans_cut)
         {
-            for(z=0;z<=7;z++)
+            lit = ~surface[0][row]; //缓冲区低电平为亮, 取反后按"亮"计算
+            for (s = 1; s < surface_used; ++s)
             {
-                choose_line(y,z,~0b00000000);
+                src = ~surface[s][row];
+                if (surface_blend[s] == blend_or)
+                    lit |= src;
+                else if (surface_blend[s] == blend_and)
+                    lit &= src;
+                else if (surface_blend[s] == blend_xor)
+                    lit ^= src;
+                else if (surface_blend[s] == blend_mask)
+                    lit &= ~src;
+                else;
             }
+            lit = ~lit;
+            
+            if (trans_type != trans_cut)
+            {
+                //keep 中为 1 的位仍显示旧画面
+                if (trans_type == trans_wipe_x)
+                    keep = 0b11111111 << trans_step;
+                else if (trans_type == trans_wipe_y)
+                    keep = ((row & (CUBE_SIZE - 1)) >= trans_step) ? 0b11111111 : 0;
+                else if (trans_type == trans_wipe_z)
+                    keep = ((row / CUBE_SIZE) >= trans_step) ? 0b11111111 : 0;
+                else
+                    keep = ~trans_mask[row];
+                lit = (lit & ~keep) | (trans_from[row] & keep);
+            }
+            display_buffer[row] = lit;
+            ++compose_rows;
+        }
+        mask <<= 1;
+        if (mask == 0)
+        {
+            *dirty++ = 0;
+            mask = 0b00000001;
         }
     }
-    else
-    {
-        //do nothing
-    }
+#endif
 }
 
-void op_V(uint8_t start, uint8_t end, uint8_t state)
+void start_transition(uint8_t type)
 {
-    uint8_t y,z;
-    if (state == led_up)
+#if COMPOSE_ENABLE
+    trans_type = type;
+    if (type == trans_cut)
+        return;
+    
+    memcpy(trans_from, frame_src, BUF_SIZE);
+    memset(trans_mask, 0, BUF_SIZE);
+    trans_step = 0;
+    trans_lfsr = 1;
+#endif
+}
+
+void step_transition()
+{
+#if COMPOSE_ENABLE
+    uint8_t i;
+    uint16_t v;
+    
+    if (trans_type == trans_cut)
+        return;
+    
+    if (++trans_step > TRANS_TICKS)
     {
-        for(y=start;y<=end;y++)
+        trans_type = trans_cut;
+        mark_dirty_all(); //结束时整帧按新画面重新合成
+        return;
+    }
+    
+    if (trans_type == trans_dissolve)
+    {
+        //最大长度 LFSR 不重复地走遍 1..体素数-1, 即体素的一个固定排列
+        for (i = 0; i < TRANS_DISSOLVE_STEP; ++i)
         {
-            choose_line(y,0,~0b11000011);
-            choose_line(y,1,~0b11000011);
-            choose_line(y,2,~0b01100110);
-            choose_line(y,3,~0b01100110);
-            choose_line(y,4,~0b01100110);
-            choose_line(y,5,~0b00111100);
-            choose_line(y,6,~0b00111100);
-            choose_line(y,7,~0b00011000);
+            v = trans_lfsr;
+            trans_mask[v / CUBE_SIZE] |= (1 << (v & (CUBE_SIZE - 1)));
+            trans_lfsr = (v >> 1) | (((v ^ (v >> TRANS_LFSR_TAP)) & 1) << (TRANS_LFSR_BITS - 1));
         }
+        if (trans_step == TRANS_TICKS)
+            trans_mask[0] |= 0b00000001; //LFSR 不会产生 0
     }
-    else if (state == led_down)
+#endif
+}
+
+
+#if UART_ENABLE
+void uart_init()
+{
+    TRISC |= 0b10000000; //RX
+    SPBRGH = UART_BAUD_BRG >> 8;
+    SPBRG = UART_BAUD_BRG & 0xFF;
+    BRG16 = 1;
+    BRGH = 1;
+    SYNC = 0;
+    SPEN = 1;
+    CREN = 1;
+#if BAR_ENABLE
+    bar_rx_pos = 0xFF;
+#endif
+#if PREVIEW_ENABLE
+    TXSEL = 1; //TX 默认在 RC6, 与层选冲突, 移到 RB6
+    TRISB &= 0b10111111;
+    TXEN = 1;
+#endif
+    RCIE = 1;
+    PEIE = 1;
+}
+
+void uart_isr()
+{
+    uint8_t data;
+#if BAR_ENABLE
+    uint8_t i;
+    uint8_t *dst;
+#endif
+    
+    if (OERR) //溢出后必须重启接收
     {
-        for(y=start;y<=end;y++)
+        CREN = 0;
+        CREN = 1;
+    }
+    data = RCREG;
+    
+#if BAR_ENABLE
+    if (bar_rx_pos == 0xFF)
+    {
+        if ((data & 0b11110000) == bar_sync)
         {
-            for(z=0;z<=7;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            bar_rx_mode = data & 0b00001111;
+            bar_rx_pos = 0;
         }
+        return;
     }
-    else
+    
+    bar_rx[bar_rx_pos] = data;
+    if (++bar_rx_pos < BAR_PKT_SIZE)
+        return;
+    
+    //整包收齐才展开, 低 4 位是 x 为偶数的柱
+    dst = bar_target;
+    for (i = 0; i < BAR_PKT_SIZE; ++i)
     {
-        //do nothing
+        data = bar_rx[i];
+        *dst++ = (data & 0b00001111) > CUBE_SIZE ? CUBE_SIZE : (data & 0b00001111);
+        *dst++ = (data >> 4) > CUBE_SIZE ? CUBE_SIZE : (data >> 4);
     }
+    bar_mode = bar_rx_mode;
+    bar_ready = 1;
+    bar_hold = BAR_TIMEOUT;
+#if !RENDER_DEPTH
+    //不等下一次 timer0, 下一个快节拍 (4ms 内) 就画出来
+    flash_frame = 0;
+    fast_fx = &fast_bars;
+    fast_kick = 1;
+#else
+    bar_flush = 1; //主循环可能正在改 render_tail, 由它清空队列后在下一帧画出
+#endif
+    bar_rx_pos = 0xFF;
+    ++bar_packets;
+#endif
 }
+#endif
 
-void op_E(uint8_t start, uint8_t end, uint8_t state)
+#if PREVIEW_ENABLE
+#define preview_idle 0
+#define preview_head 1
+#define preview_index 2
+#define preview_data 3
+#define preview_check 4
+
+#define preview_send(b) { preview_sum ^= (b); TXREG = (b); }
+
+//TXREG 空时发出一个字节; 只在扫描等待或渲染空闲时调用, 不用 TX 中断
+void preview_poll()
 {
-    uint8_t y,z;
-    if (state == led_up)
+    uint8_t n;
+    const uint8_t *src;
+    
+    if (!TXIF)
+        return;
+    
+    if (preview_state == preview_idle)
     {
-        for(y=start;y<=end;y++)
-        {
-            choose_line(y,0,~0b11111111);
-            choose_line(y,1,~0b11111111);
-            choose_line(y,2,~0b11100000);
-            choose_line(y,3,~0b11111110);
-            choose_line(y,4,~0b11111110);
-            choose_line(y,5,~0b11100000);
-            choose_line(y,6,~0b11111111);
-            choose_line(y,7,~0b11111111);
-        }
+        if (!preview_due)
+            return;
+        preview_due = 0;
+        preview_key = (preview_seq % PREVIEW_KEY == 0);
+        preview_pos = 0;
+        preview_sum = 0;
+        TXREG = preview_sync | preview_key;
+        preview_state = preview_head;
     }
-    else if (state == led_down)
+    else if (preview_state == preview_head)
     {
-        for(y=start;y<=end;y++)
+        preview_send(preview_seq);
+        ++preview_seq;
+        preview_state = preview_index;
+    }
+    else if (preview_state == preview_index)
+    {
+        //与 scan_src 比较, 一包可能跨越几帧, 但主机的画面始终与 preview_last 一致
+        GIE = 0; //scan_src 由 timer0 在中断里改写
+        src = scan_src;
+        GIE = 1;
+        for (n = PREVIEW_SCAN; n && preview_pos < BUF_SIZE; --n, ++preview_pos)
         {
-            for(z=0;z<=7;z++)
+            if (preview_key || src[preview_pos] != preview_last[preview_pos])
             {
-                choose_line(y,z,~0b00000000);
+                preview_val = src[preview_pos];
+                preview_send(preview_pos);
+                preview_state = preview_data;
+                return;
             }
         }
+        if (preview_pos < BUF_SIZE)
+            return; //下次接着找
+        preview_send(preview_end);
+        preview_state = preview_check;
+    }
+    else if (preview_state == preview_data)
+    {
+        preview_last[preview_pos] = preview_val;
+        preview_send(preview_val);
+        ++preview_pos;
+        preview_state = preview_index;
     }
     else
     {
-        //do nothing
+        TXREG = preview_sum;
+        preview_state = preview_idle;
+        ++preview_packets;
     }
 }
+#endif
 
-void trans_display_love()
+#if BTN_ENABLE
+void button_init()
 {
-    static uint8_t love_idx;
-    if (love_idx<8) //display L
+    ANSELB &= ~BTN_MASK;
+    TRISB |= BTN_MASK;
+    WPUB |= BTN_MASK;
+    IOCBP |= BTN_MASK; //按下和松开都触发
+    IOCBN |= BTN_MASK;
+    IOCBF &= ~BTN_MASK;
+    IOCIE = 1;
+}
+
+//消抖结束, 中断里调用: 新按下的键放入队列
+void button_sample()
+{
+    uint8_t now, pressed, ev;
+    
+    now = ~PORTB & BTN_MASK;
+    pressed = now & ~btn_state;
+    btn_state = now;
+    for (ev = 0; pressed; ++ev, pressed >>= 1)
     {
-        op_L(0, love_idx, led_up);
+        if (!(pressed & 1))
+            continue;
+        if ((uint8_t)(btn_tail - btn_head) >= BTN_QUEUE_SIZE)
+        {
+            ++btn_dropped;
+            continue;
+        }
+        btn_queue[btn_tail & (BTN_QUEUE_SIZE - 1)] = ev;
+        ++btn_tail; //写好数据再移动, 消费者不会读到半个事件
     }
-    else if (love_idx<16)
+}
+
+//帧开始时调用, 改动从这一帧起生效
+void button_apply()
+{
+    uint8_t ev;
+    
+    while (btn_head != btn_tail)
     {
-        op_L(love_idx-8, love_idx-8, led_down);
+        ev = btn_queue[btn_head & (BTN_QUEUE_SIZE - 1)];
+        ++btn_head;
+        if (ev == btn_next || ev == btn_prev)
+        {
+            if (ev == btn_next)
+                play_idx = (play_idx + 1 >= PLAY_NUM) ? 0 : play_idx + 1;
+            else
+                play_idx = (play_idx == 0) ? PLAY_NUM - 1 : play_idx - 1;
+            play_tick = 0;
+            play_paused = 0;
+#if BAR_ENABLE
+            bar_hold = 0;
+#endif
+        }
+        else if (ev == btn_pause)
+            play_paused ^= 1;
+        else if (ev == btn_bright)
+        {
+            if (++scan_bright >= BRIGHT_LEVELS)
+                scan_bright = 0;
+        }
+#if RENDER_DEPTH
+        if (ev != btn_bright) //丢掉队列里按旧状态渲染的帧, 下一次 timer0 就换上新的一帧
+        {
+            GIE = 0; //timer0 在中断里改写 render_head
+            render_tail = render_head;
+            GIE = 1;
+            render_wait = 0;
+        }
+#endif
     }
-    else if (love_idx<24)
+}
+#endif
+
+
+#if SYNC_ROLE != sync_none
+void sync_init()
+{
+    //默认 SDA 在 RC4 上与层选冲突, SCL/SDA 一起移到 RB7/RB6
+    SCKSEL = 1;
+    SDISEL = 1;
+    ANSELB &= 0b00111111;
+    TRISB |= 0b11000000;
+    
+#if SYNC_ROLE == sync_master
+    SSPADD = SYNC_I2C_BAUD;
+    SSPCON1 = 0b00101000; //SSPEN, I2C 主机
+#else
+    SSPADD = SYNC_ADDR << 1;
+    SSPCON1 = 0b00110110; //SSPEN, CKP, I2C 从机 7 位地址
+    GCEN = 1;             //接收广播地址
+    sync_next = 0xFF;
+#endif
+    sync_state = sync_idle;
+    SSPIF = 0;
+    SSPIE = 1;
+    PEIE = 1;
+}
+
+#if SYNC_ROLE == sync_master
+void sync_send()
+{
+    if (sync_state != sync_idle)
     {
-        op_O(0, love_idx-16, led_up);
+        ++sync_overrun;
+        return;
     }
-    else if (love_idx<32)
+    
+    sync_pkt[0] = sync_cmd_tick;
+    sync_pkt[1] = play_idx;
+    sync_pkt[2] = play_tick;
+    sync_state = sync_ready; //等 display() 下次换层时填上层号再发
+}
+
+//display() 在开 OE 后调用: 包里的层号就是刚点亮的这一层, grid 为它在层周期网格上开始消隐的时刻.
+//刚在中断里渲染完, 这一层通常还在追赶 scan_due, 开 OE 比 grid 晚; 之后各字节也可能被别的中断推迟,
+//所以先存下 grid, 到发时间差那个字节时再减
+void sync_start_send(uint16_t grid)
+{
+    sync_pkt[3] = scan_slot;
+    sync_pkt[4] = (uint8_t)grid;
+    sync_pkt[5] = grid >> 8;
+    sync_pos = 0;
+    sync_state = sync_start;
+    SEN = 1;
+}
+
+void sync_isr()
+{
+    uint16_t late;
+    
+    if (sync_state == sync_start)
     {
-        op_O(love_idx-24, love_idx-24, led_down);
+        SSPBUF = 0x00; //广播地址, 写
+        sync_state = sync_data;
     }
-    else if (love_idx<40) //display L
+    else if (sync_state == sync_data)
     {
-        op_V(0, love_idx-32, led_up);
+        if (ACKSTAT)
+        {
+            ++sync_nack;
+            sync_pos = SYNC_PKT_SIZE;
+        }
+        if (sync_pos == 4)
+        {
+            late = read_tmr1() - (sync_pkt[4] | ((uint16_t)sync_pkt[5] << 8));
+            sync_pkt[4] = (uint8_t)late;
+            sync_pkt[5] = late >> 8;
+        }
+        if (sync_pos < SYNC_HDR_SIZE)
+            SSPBUF = sync_pkt[sync_pos++];
+#if SYNC_FRAME_DATA
+        else if (sync_pos < SYNC_PKT_SIZE)
+            SSPBUF = scan_src[sync_pos++ - SYNC_HDR_SIZE];
+#endif
+        else
+        {
+            PEN = 1;
+            sync_state = sync_stop;
+        }
     }
-    else if (love_idx<48)
+    else if (sync_state == sync_stop)
     {
-        op_V(love_idx-40, love_idx-40, led_down);
+        sync_state = sync_idle;
     }
-    else if (love_idx<56)
+    else;
+}
+#else
+void sync_isr()
+{
+    uint8_t data;
+    
+    data = SSPBUF;
+    SSPOV = 0;
+    if (!D_nA) //地址字节, 新的一包开始
     {
-        op_E(0, love_idx-48, led_up);
+        sync_pos = 0;
+        return;
     }
-    else if (love_idx<64)
+    
+    if (sync_pos == 4)
+        sync_at = read_tmr1(); //主机在发这个字节前算好时间差
+    if (sync_pos < SYNC_HDR_SIZE)
+        sync_pkt[sync_pos] = data;
+#if SYNC_FRAME_DATA
+    else if (sync_pos < SYNC_PKT_SIZE)
+        draw_buffer[sync_pos - SYNC_HDR_SIZE] = data;
+#endif
+    else
+        return;
+    
+    if (++sync_pos < SYNC_PKT_SIZE || sync_pkt[0] != sync_cmd_tick)
+        return;
+    if (sync_pkt[1] >= PLAY_NUM || sync_pkt[2] >= playlist[sync_pkt[1]].ticks || sync_pkt[3] >= CUBE_SIZE)
     {
-        op_V(love_idx-56, love_idx-56, led_down);
+        ++sync_bad; //传输出错或主机的 playlist 不同, 照这包播放会越界
+        return;
     }
-    if (++love_idx == 64)
-        love_idx = 0;
+    
+    sync_at -= SYNC_LAG_CYCLES + (sync_pkt[4] | ((uint16_t)sync_pkt[5] << 8));
+    sync_next = sync_pkt[3]; //display() 正在移位或消隐时不能改 scan_slot, 等它换层时再套用
+    
+    if (play_idx != sync_pkt[1] || play_tick != sync_pkt[2])
+    {
+        play_idx = sync_pkt[1];
+        play_tick = sync_pkt[2];
+        ++sync_resync;
+#if !SYNC_FRAME_DATA
+        sync_hold = (play_tick != 0);
+#endif
+    }
+    
+#if SYNC_FRAME_DATA
+    //画面已是主机合成后的结果, 不再自己播放
+    mark_dirty_all();
+    compose_display();
+#else
+    timer0();
+#endif
 }
+#endif
+#endif
 
 
-void op_circle(uint8_t start, uint8_t end, uint8_t state)
+void choose_led(uint8_t x, uint8_t y, uint8_t z, uint8_t state)
 {
-    uint8_t y,z;
+    buf_idx_t i;
+    i = (z * CUBE_SIZE + y) * ROW_BYTES + (x >> 3);
     
     if (state == led_up)
     {
-        for(y=start;y<=end;y++)
-        {
-            for(z=start;z<=end;z++)
-            {
-                if (start==3 && end==4)
-                {
-                    choose_line(y,z,~0b00011000);
-                }
-                else if (start==2 && end==5)
-                {
-                    choose_line(y,z,~0b00111100);
-                }
-                else if (start==1 && end==6)
-                {
-                    choose_line(y,z,~0b01111110);
-                }
-                else if (start==0 && end==7)
-                {
-                    choose_line(y,z,~0b11111111);
-                }
-                else
-                {
-                    //do nothing
-                }
-            }
-        }
+        draw_buffer[i] &= ~(1 << (x & 7));
     }
-    else if (state==led_down)
+    else if (state == led_down)
     {
-        for(y=start;y<=end;y++)
-        {
-            for(z=start;z<=end;z++)
-            {
-                if (start==3 && end==4)
-                {
-                    choose_line(y,z,0b00011000);
-                }
-                else if (start==2 && end==5)
-                {
-                    choose_line(y,z,0b00111100);
-                }
-                else if (start==1 && end==6)
-                {
-                    choose_line(y,z,0b01111110);
-                }
-                else if (start==0 && end==7)
-                {
-                    choose_line(y,z,0b11111111);
-                }
-                else
-                {
-                    //do nothing
-                }
-            }
-        }
+        draw_buffer[i] |= (1 << (x & 7));
     }
-    else;
+    else
+    {
+        return;
+    }
+    mark_dirty(z * CUBE_SIZE + y);
 }
 
-void trans_display_heart() {
-    uint8_t y,z;
-    static uint8_t graph_idx_heart;
+void choose_line(uint8_t y, uint8_t z, row_t sequence)
+{
+    buf_idx_t i;
+    i = (z * CUBE_SIZE + y) * ROW_BYTES;
+    
+    draw_buffer[i] = (uint8_t)sequence;
+#if ROW_BYTES > 1
+    draw_buffer[i + 1] = (uint8_t)(sequence >> 8);
+#endif
+    mark_dirty(z * CUBE_SIZE + y);
+}
+
+void draw_packed_frame(const packed_anim_t *anim, uint8_t frame)
+{
+    const uint8_t *mask;
+    const uint8_t *src;
+    buf_idx_t row, i;
+    uint8_t m, bit, b;
     
-    if (graph_idx_heart < 2)
+    mask = anim->data + anim->offset[frame];
+    src = mask + ROW_NUM / 8;
+    i = 0;
+    for (row = 0; row < ROW_NUM; row += 8)
     {
-        memset(display_buffer, 0b11111111, BUF_SIZE);
-        for(y=3;y<=4;y++)
+        m = *mask++;
+        for (bit = 0; bit < 8; ++bit)
         {
-            for(z=3;z<=4;z++)
-            {
-                choose_line(y,z,~0b00011000);
-            }
+            for (b = 0; b < ROW_BYTES; ++b)
+                draw_buffer[i++] = (m & 1) ? *src++ : 0b11111111;
+            m >>= 1;
         }
     }
-    else if (graph_idx_heart < 4)
+    mark_dirty_all();
+}
+
+void play_packed_anim(const packed_anim_t *anim, uint8_t *step, uint8_t *tick)
+{
+    if (show_start)
     {
-        for(y=2;y<=5;y++)
-        {
-            for(z=2;z<=5;z++)
-            {
-                choose_line(y,z,~0b00111100);
-            }
-        }
+        *step = 0;
+        *tick = 0;
     }
-    else if (graph_idx_heart < 6)
+    if (*tick == 0)
+        draw_packed_frame(anim, anim->seq[*step]);
+    
+    if (++*tick >= anim->hold[*step])
     {
-        for(y=1;y<=6;y++)
-        {
-            for(z=1;z<=6;z++)
-            {
-                choose_line(y,z,~0b01111110);
-            }
-        }
+        *tick = 0;
+        if (++*step >= anim->steps)
+            *step = 0;
     }
-    else if (graph_idx_heart < 8)
+}
+
+void play_flash_anim(const flash_anim_t *anim, uint8_t *frame, uint8_t *tick)
+{
+    if (show_start)
     {
-        for(y=0;y<=7;y++)
-        {
-            for(z=0;z<=7;z++)
-            {
-                choose_line(y,z,~0b11111111);
-            }
-        }
+        *frame = 0;
+        *tick = 0;
     }
-    else if (graph_idx_heart < 9);
-    //wait
-    else if (graph_idx_heart < 11)
+    //每个节拍只更新指针
+    flash_frame = anim->data + (uint16_t)*frame * BUF_SIZE;
+    
+    if (++*tick >= anim->hold[*frame])
     {
-        for(y=1;y<=6;y++)
-        {
-            for(z=1;z<=6;z++)
-            {
-                choose_line(y,z,~0b01111110);
-            }
-        }
-        for(z=0;z<=7;z++)
-        {
-            choose_line(0,z,~0b00000000);
-            choose_line(7,z,~0b00000000);
-        }
-        for(y=1;y<=6;y++)
-        {
-            choose_line(y,0,~0b00000000);
-            choose_line(y,7,~0b00000000);
-        }
+        *tick = 0;
+        if (++*frame >= anim->frames)
+            *frame = 0;
     }
-    else if (graph_idx_heart < 13)
+}
+
+#if CUBE_SIZE == 8
+//低 4 位按位翻转后放到高 4 位: x -> 7-x
+const uint8_t mirror_nibble[16] = {
+    0b00000000, 0b10000000, 0b01000000, 0b11000000,
+    0b00100000, 0b10100000, 0b01100000, 0b11100000,
+    0b00010000, 0b10010000, 0b01010000, 0b11010000,
+    0b00110000, 0b10110000, 0b01110000, 0b11110000,
+};
+
+void draw_sym_frame(const sym_anim_t *anim, uint8_t frame)
+{
+    uint8_t y, z, ny, nz, size, row;
+    const uint8_t *src;
+    
+    ny = (anim->sym & SYM_Y) ? 4 : 8;
+    nz = (anim->sym & SYM_Z) ? 4 : 8;
+    size = ny * nz;
+    if (anim->sym & SYM_X)
+        size >>= 1;
+    src = anim->data + frame * size;
+    
+    for (z = 0; z < nz; ++z)
     {
-        for(y=2;y<=5;y++)
+        for (y = 0; y < ny; ++y)
         {
-            for(z=2;z<=5;z++)
+            if (anim->sym & SYM_X)
             {
-                choose_line(y,z,~0b00111100);
+                if (y & 1)
+                    row = *src++ >> 4;
+                else
+                    row = *src & 0b00001111;
+                row |= mirror_nibble[row];
             }
-        }
-        for(z=1;z<=6;z++)
-        {
-            choose_line(1,z,~0b00000000);
-            choose_line(6,z,~0b00000000);
-        }
-        for(y=2;y<=5;y++)
-        {
-            choose_line(y,1,~0b00000000);
-            choose_line(y,6,~0b00000000);
-        }
-    }
-    else if (graph_idx_heart < 15)
-    {
-        for(y=3;y<=4;y++)
-        {
-            for(z=3;z<=4;z++)
+            else
             {
-                choose_line(y,z,~0b00011000);
+                row = *src++;
             }
-        }
-        for(z=2;z<=5;z++)
-        {
-            choose_line(2,z,~0b00000000);
-            choose_line(5,z,~0b00000000);
-        }
-        for(y=3;y<=4;y++)
-        {
-            choose_line(y,2,~0b00000000);
-            choose_line(y,5,~0b00000000);
-        }
-    }
-    else if (graph_idx_heart < 17)
-    {
-        for(y=3;y<=4;y++)
-        {
-            for(z=3;z<=4;z++)
+            
+            draw_buffer[z*8+y] = row;
+            if (anim->sym & SYM_Y)
+                draw_buffer[z*8+7-y] = row;
+            if (anim->sym & SYM_Z)
             {
-                choose_line(y,z,~0b00000000);
+                draw_buffer[(7-z)*8+y] = row;
+                if (anim->sym & SYM_Y)
+                    draw_buffer[(7-z)*8+7-y] = row;
             }
         }
     }
-    
-    if (++graph_idx_heart >= 17) {
-        graph_idx_heart = 0;
-    }
+    mark_dirty_all();
 }
 
-void trans_display_circle() {
-    uint8_t y,z;
-    static uint8_t graph_idx_circle;
+void play_sym_anim(const sym_anim_t *anim, uint8_t *frame, uint8_t *tick)
+{
+    uint8_t f;
     
-    if (graph_idx_circle < 2)
+    if (show_start) //从按键或 playlist 进入本段, 都从第一帧开始
     {
-        for(y=3;y<=4;y++)
-        {
-            for(z=3;z<=4;z++)
-            {
-                choose_line(y,z,~0b00011000);
-            }
-        }
+        *frame = 0;
+        *tick = 0;
     }
-    else if (graph_idx_circle < 4)
-    {
-        for(y=3;y<=4;y++)
-        {
-            for(z=3;z<=4;z++)
-            {
-                choose_line(y,z,~0b00100100);
-            }
-        }
-        for(y=2;y<=5;y++)
-        {
-            choose_line(y,2,~0b00111100);
-            choose_line(y,5,~0b00111100);
-        }
-        for(z=3;z<=4;z++)
-        {
-            choose_line(2,z,~0b00111100);
-            choose_line(5,z,~0b00111100);
-        }
-    }
-    else if (graph_idx_circle < 6)
+    f = *frame;
+    if (anim->sym & SYM_REVERSE)
+        f = anim->frames - 1 - f;
+    
+    if (*tick == 0) //保持期间画面不变, 不必重画
+        draw_sym_frame(anim, f);
+    
+    if (++*tick >= anim->hold[f])
     {
-        for(y=2;y<=5;y++)
-        {
-            for(z=2;z<=5;z++)
-            {
-                choose_line(y,z,~0b01000010);
-            }
-        }
-        for(y=1;y<=6;y++)
-        {
-            choose_line(y,1,~0b01111110);
-            choose_line(y,6,~0b01111110);
-        }
-        for(z=2;z<=5;z++)
-        {
-            choose_line(1,z,~0b01111110);
-            choose_line(6,z,~0b01111110);
-        }
+        *tick = 0;
+        if (++*frame >= anim->frames)
+            *frame = 0;
     }
-    else if (graph_idx_circle < 8)
+}
+
+
+void op_L(uint8_t start, uint8_t end, uint8_t state)
+{
+    uint8_t y,z;
+    if (state == led_up)
     {
-        for(y=1;y<=6;y++)
-        {
-            for(z=1;z<=6;z++)
-            {
-                choose_line(y,z,~0b1000001);
-            }
-        }
-        for(y=0;y<=7;y++)
+        for(y=start;y<=end;y++)
         {
-            choose_line(y,0,~0b11111111);
+            choose_line(y,0,~0b11100000);
+            choose_line(y,1,~0b11100000);
+            choose_line(y,2,~0b11100000);
+            choose_line(y,3,~0b11100000);
+            choose_line(y,4,~0b11100000);
+            choose_line(y,5,~0b11111111);
+            choose_line(y,6,~0b11111111);
             choose_line(y,7,~0b11111111);
         }
-        for(z=1;z<=6;z++)
-        {
-            choose_line(0,z,~0b11111111);
-            choose_line(7,z,~0b11111111);
-        }
     }
-    else if (graph_idx_circle < 9);
-    //wait
-    else if (graph_idx_circle < 11)
+    else if (state == led_down)
     {
-        for(y=2;y<=5;y++)
+        for(y=start;y<=end;y++)
         {
-            for(z=2;z<=5;z++)
+            for(z=0;z<=7;z++)
             {
-                choose_line(y,z,~0b01000010);
+                choose_line(y,z,~0b00000000);
             }
         }
-        for(z=1;z<=6;z++)
-        {
-            choose_line(1,z,~0b01111110);
-            choose_line(6,z,~0b01111110);
-        }
-        for(y=2;y<=5;y++)
-        {
-            choose_line(y,1,~0b01111110);
-            choose_line(y,6,~0b01111110);
-        }
-        for(z=0;z<=7;z++)//暗
-        {
-            choose_line(0,z,~0b00000000);
-            choose_line(7,z,~0b00000000);
-        }
-        for(y=1;y<=6;y++)
-        {
-            choose_line(y,0,~0b00000000);
-            choose_line(y,7,~0b00000000);
-        }
     }
-    else if (graph_idx_circle < 13)
+    else
     {
-        for(y=3;y<=4;y++)
-        {
-            for(z=3;z<=4;z++)
-            {
-                choose_line(y,z,~0b00100100);
-            }
-        }
-        for(z=2;z<=5;z++)
-        {
-            choose_line(2,z,~0b00111100);
-            choose_line(5,z,~0b00111100);
-        }
-        for(y=3;y<=4;y++)
-        {
-            choose_line(y,2,~0b00111100);
-            choose_line(y,5,~0b00111100);
-        }
-        for(z=1;z<=6;z++)//暗
-        {
-            choose_line(1,z,~0b00000000);
-            choose_line(6,z,~0b00000000);
-        }
-        for(y=2;y<=5;y++)
-        {
-            choose_line(y,1,~0b00000000);
-            choose_line(y,6,~0b00000000);
-        }
+        //do nothing
     }
-    else if (graph_idx_circle < 15)
+}
+
+void op_O(uint8_t start, uint8_t end, uint8_t state)
+{
+    uint8_t y,z;
+    if (state == led_up)
     {
-        for(z=3;z<=4;z++)
-        {
-            choose_line(3,z,~0b00011000);
-            choose_line(4,z,~0b00011000);
-        }
-        for(z=2;z<=5;z++)//暗
-        {
-            choose_line(2,z,~0b00000000);
-            choose_line(5,z,~0b00000000);
-        }
-        for(y=3;y<=4;y++)
+        for(y=start;y<=end;y++)
         {
-            choose_line(y,2,~0b00000000);
-            choose_line(y,5,~0b00000000);
+            choose_line(y,0,~0b00111100);
+            choose_line(y,1,~0b01100110);
+            choose_line(y,2,~0b11000011);
+            choose_line(y,3,~0b11000011);
+            choose_line(y,4,~0b11000011);
+            choose_line(y,5,~0b11000011);
+            choose_line(y,6,~0b01100110);
+            choose_line(y,7,~0b00111100);
         }
     }
-    else if (graph_idx_circle < 17)
+    else if (state == led_down)
     {
-        for(y=3;y<=4;y++)//暗
+        for(y=start;y<=end;y++)
         {
-            for(z=3;z<=4;z++)
+            for(z=0;z<=7;z++)
             {
                 choose_line(y,z,~0b00000000);
             }
         }
     }
-    
-    if (++graph_idx_circle >= 17) {
-        graph_idx_circle = 0;
+    else
+    {
+        //do nothing
     }
 }
 
-
-void op_cell_start()
+void op_V(uint8_t start, uint8_t end, uint8_t state)
 {
     uint8_t y,z;
-    static uint8_t cell_start_idx;
-    
-    if (cell_start_idx < 2)
+    if (state == led_up)
     {
-        for (y=0;y<8;y++)
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            choose_line(y,0,~0b11000011);
+            choose_line(y,1,~0b11000011);
+            choose_line(y,2,~0b01100110);
+            choose_line(y,3,~0b01100110);
+            choose_line(y,4,~0b01100110);
+            choose_line(y,5,~0b00111100);
+            choose_line(y,6,~0b00111100);
+            choose_line(y,7,~0b00011000);
         }
     }
-    else if (cell_start_idx < 4)
+    else if (state == led_down)
     {
-        for (y=0;y<3;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
-        for (y=3;y<5;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00011000);
-            }
-        }
-        for (y=5;y<8;y++)
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
+            for(z=0;z<=7;z++)
             {
                 choose_line(y,z,~0b00000000);
             }
         }
     }
-    else if (cell_start_idx < 6)
+    else
     {
-        for (y=0;y<2;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
-        for (y=2;y<6;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00111100);
-            }
-        }
-        for (y=6;y<8;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
+        //do nothing
     }
-    else if (cell_start_idx < 8)
+}
+
+void op_E(uint8_t start, uint8_t end, uint8_t state)
+{
+    uint8_t y,z;
+    if (state == led_up)
     {
-        for (y=0;y<1;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
-        for (y=1;y<7;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b01100110);
-            }
-        }
-        for (y=7;y<8;y++)
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            choose_line(y,0,~0b11111111);
+            choose_line(y,1,~0b11111111);
+            choose_line(y,2,~0b11100000);
+            choose_line(y,3,~0b11111110);
+            choose_line(y,4,~0b11111110);
+            choose_line(y,5,~0b11100000);
+            choose_line(y,6,~0b11111111);
+            choose_line(y,7,~0b11111111);
         }
     }
-    else if (cell_start_idx < 10)
+    else if (state == led_down)
     {
-        for (y=0;y<2;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b11000011);
-            }
-        }
-        for (y=2;y<6;y++)
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
+            for(z=0;z<=7;z++)
             {
                 choose_line(y,z,~0b00000000);
             }
         }
-        for (y=6;y<8;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b11000011);
-            }
-        }
     }
-    
-    if(++cell_start_idx >= 10)
-        cell_start_idx = 0;
+    else
+    {
+        //do nothing
+    }
 }
 
-void op_cell_rotate()
+void trans_display_love()
 {
-    uint8_t y,z;
-    static uint8_t cell_rotate_idx;
-    
-    if (cell_rotate_idx < 1)
+    static uint8_t love_idx;
+    if (show_start)
+        love_idx = 0;
+    if (love_idx<8) //display L
     {
-        for (y=0;y<2;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b11000011);
-            }
-        }
-        for (y=2;y<6;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
-        for (y=6;y<8;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b11000011);
-            }
-        }
+        op_L(0, love_idx, led_up);
     }
-    else if (cell_rotate_idx < 2)
+    else if (love_idx<16)
     {
-        for (z=0;z<8;z++)
-        {
-            choose_line(0,z,~0b01100000);
-            choose_line(1,z,~0b01100011);
-            choose_line(2,z,~0b00000011);
-            choose_line(3,z,~0b00000000);
-            choose_line(4,z,~0b00000000);
-            choose_line(5,z,~0b11000000);
-            choose_line(6,z,~0b11000110);
-            choose_line(7,z,~0b00000110);
-        }
+        op_L(love_idx-8, love_idx-8, led_down);
     }
-    else if (cell_rotate_idx < 3)
+    else if (love_idx<24)
     {
-        for (z=0;z<8;z++)
-        {
-            choose_line(0,z,~0b00110000);
-            choose_line(1,z,~0b00110000);
-            choose_line(2,z,~0b00000011);
-            choose_line(3,z,~0b00000011);
-            choose_line(4,z,~0b11000000);
-            choose_line(5,z,~0b11000000);
-            choose_line(6,z,~0b00001100);
-            choose_line(7,z,~0b00001100);
-        }
+        op_O(0, love_idx-16, led_up);
     }
-    else if (cell_rotate_idx < 4)
+    else if (love_idx<32)
     {
-        for (z=0;z<8;z++)
-        {
-            choose_line(0,z,~0b00011000);
-            choose_line(1,z,~0b00011000);
-            choose_line(2,z,~0b00000000);
-            choose_line(3,z,~0b11000011);
-            choose_line(4,z,~0b11000011);
-            choose_line(5,z,~0b00000000);
-            choose_line(6,z,~0b00011000);
-            choose_line(7,z,~0b00011000);
-        }
+        op_O(love_idx-24, love_idx-24, led_down);
+    }
+    else if (love_idx<40) //display L
+    {
+        op_V(0, love_idx-32, led_up);
     }
-    else if (cell_rotate_idx < 5)
+    else if (love_idx<48)
     {
-        for (z=0;z<8;z++)
-        {
-            choose_line(0,z,~0b00001100);
-            choose_line(1,z,~0b00001100);
-            choose_line(2,z,~0b11000000);
-            choose_line(3,z,~0b11000000);
-            choose_line(4,z,~0b00000011);
-            choose_line(5,z,~0b00000011);
-            choose_line(6,z,~0b00110000);
-            choose_line(7,z,~0b00110000);
-        }
+        op_V(love_idx-40, love_idx-40, led_down);
     }
-    else if (cell_rotate_idx < 6)
+    else if (love_idx<56)
     {
-        for (z=0;z<8;z++)
-        {
-            choose_line(0,z,~0b00000110);
-            choose_line(1,z,~0b11000110);
-            choose_line(2,z,~0b11000000);
-            choose_line(3,z,~0b00000000);
-            choose_line(4,z,~0b00000000);
-            choose_line(5,z,~0b00000011);
-            choose_line(6,z,~0b01100011);
-            choose_line(7,z,~0b01100000);
-        }
+        op_E(0, love_idx-48, led_up);
+    }
+    else if (love_idx<64)
+    {
+        op_V(love_idx-56, love_idx-56, led_down);
     }
-//    else if (cell_rotate_idx < 7)
-//    {
-//        for (z=0;z<8;z++)
-//        {
-//            choose_line(0,z,~0b00000110);
-//            choose_line(1,z,~0b11000110);
-//            choose_line(2,z,~0b11000000);
-//            choose_line(3,z,~0b00000000);
-//            choose_line(4,z,~0b00000000);
-//            choose_line(5,z,~0b00000011);
-//            choose_line(6,z,~0b01100011);
-//            choose_line(7,z,~0b01100000);
-//        }
-//    }
-    if (++cell_rotate_idx >= 7)
-        cell_rotate_idx = 0;
+    if (++love_idx == 64)
+        love_idx = 0;
 }
 
-void op_cell_end()
+//合成层的用法: 波浪画在底层, LOVE 逐个字母以 blend_xor 叠在上层, 字母处的波浪反相
+void trans_display_love_wave()
+{
+    uint8_t letter;
+    
+    fx_wave();
+    select_surface(1);
+    surface_blend[1] = blend_xor;
+    letter = (play_tick >> 4) & 3; //每个字母 16 拍
+    if (letter == 0)
+    {
+        op_L(0, 7, led_up);
+    }
+    else if (letter == 1)
+    {
+        op_O(0, 7, led_up);
+    }
+    else if (letter == 2)
+    {
+        op_V(0, 7, led_up);
+    }
+    else
+    {
+        op_E(0, 7, led_up);
+    }
+    select_surface(0);
+}
+
+
+void op_circle(uint8_t start, uint8_t end, uint8_t state)
 {
     uint8_t y,z;
-    static uint8_t cell_end_idx;
     
-    if (cell_end_idx < 2)
+    if (state == led_up)
     {
-        for (y=0;y<2;y++)
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
+            for(z=start;z<=end;z++)
             {
-                choose_line(y,z,~0b11000011);
+                if (start==3 && end==4)
+                {
+                    choose_line(y,z,~0b00011000);
+                }
+                else if (start==2 && end==5)
+                {
+                    choose_line(y,z,~0b00111100);
+                }
+                else if (start==1 && end==6)
+                {
+                    choose_line(y,z,~0b01111110);
+                }
+                else if (start==0 && end==7)
+                {
+                    choose_line(y,z,~0b11111111);
+                }
+                else
+                {
+                    //do nothing
+                }
             }
         }
-        for (y=2;y<6;y++)
+    }
+    else if (state==led_down)
+    {
+        for(y=start;y<=end;y++)
         {
-            for (z=0;z<8;z++)
+            for(z=start;z<=end;z++)
             {
-                choose_line(y,z,~0b00000000);
+                if (start==3 && end==4)
+                {
+                    choose_line(y,z,0b00011000);
+                }
+                else if (start==2 && end==5)
+                {
+                    choose_line(y,z,0b00111100);
+                }
+                else if (start==1 && end==6)
+                {
+                    choose_line(y,z,0b01111110);
+                }
+                else if (start==0 && end==7)
+                {
+                    choose_line(y,z,0b11111111);
+                }
+                else
+                {
+                    //do nothing
+                }
             }
         }
-        for (y=6;y<8;y++)
+    }
+    else;
+}
+
+//对称存储: 只保存 y<4, z<4 的部分, x 对称时每行只存低 4 位
+const uint8_t heart_hold[] = {2, 2, 2, 3, 2, 2, 2, 2};
+const uint8_t heart_data[] = {
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b01111111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00110011, 0b11111111, 0b00110011,
+    0b11111111, 0b11111111, 0b00011111, 0b00010001, 0b00011111, 0b00010001, 0b00011111, 0b00010001,
+    0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000,
+    0b11111111, 0b11111111, 0b00011111, 0b00010001, 0b00011111, 0b00010001, 0b00011111, 0b00010001,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00110011, 0b11111111, 0b00110011,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b01111111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+};
+const sym_anim_t anim_heart = {SYM_X | SYM_Y | SYM_Z, 8, heart_hold, heart_data};
+
+//第 4 帧内圈是 0b1000001, 左右不对称, 只声明 y/z 对称
+const uint8_t circle_hold[] = {2, 2, 2, 3, 2, 2, 2, 2};
+const uint8_t circle_data[] = {
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11100111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b11111111, 0b11000011, 0b11000011, 0b11111111, 0b11111111, 0b11000011, 0b11011011,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b10000001, 0b10000001, 0b10000001,
+    0b11111111, 0b10000001, 0b10111101, 0b10111101, 0b11111111, 0b10000001, 0b10111101, 0b10111101,
+    0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b10111110, 0b10111110, 0b10111110,
+    0b00000000, 0b10111110, 0b10111110, 0b10111110, 0b00000000, 0b10111110, 0b10111110, 0b10111110,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b10000001, 0b10000001, 0b10000001,
+    0b11111111, 0b10000001, 0b10111101, 0b10111101, 0b11111111, 0b10000001, 0b10111101, 0b10111101,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b11111111, 0b11000011, 0b11000011, 0b11111111, 0b11111111, 0b11000011, 0b11011011,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11100111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+};
+const sym_anim_t anim_circle = {SYM_Y | SYM_Z, 8, circle_hold, circle_data};
+
+void trans_display_heart() {
+    static uint8_t heart_frame;
+    static uint8_t heart_tick;
+    
+    play_sym_anim(&anim_heart, &heart_frame, &heart_tick);
+}
+
+void trans_display_circle() {
+    static uint8_t circle_frame;
+    static uint8_t circle_tick;
+    
+    play_sym_anim(&anim_circle, &circle_frame, &circle_tick);
+}
+
+
+//由 tools/scenes 里的两张切片图生成, 小心形跳两下后停住; 相同的帧只存一份:
+//voximport -n beat -h 2 beat_small.pbm beat_big.pbm beat_small.pbm beat_big.pbm beat_small.pbm beat_small.pbm beat_small.pbm beat_small.pbm
+const uint8_t beat_seq[] = {0, 1, 0, 1, 0, 0, 0, 0};
+const uint8_t beat_hold[] = {2, 2, 2, 2, 2, 2, 2, 2};
+const uint16_t beat_offset[] = {0, 16};
+const uint8_t beat_data[] = {
+    0b00000000, 0b00000000, 0b00011000, 0b00011000, 0b00011000, 0b00011000, 0b00000000, 0b00000000,
+    0b11100111, 0b11100111, 0b11000011, 0b11000011, 0b10000001, 0b10000001, 0b11011011, 0b11011011,
+    0b00000000, 0b00111100, 0b00111100, 0b00111100, 0b00111100, 0b00111100, 0b00111100, 0b00111100,
+    0b11100111, 0b11100111, 0b11100111, 0b11100111, 0b11000011, 0b11000011, 0b11000011, 0b11000011,
+    0b10000001, 0b10000001, 0b10000001, 0b10000001, 0b00000000, 0b00000000, 0b00000000, 0b00000000,
+    0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000,
+    0b10011001, 0b10011001, 0b10011001, 0b10011001,
+};
+const packed_anim_t anim_beat = {8, beat_seq, beat_hold, beat_offset, beat_data};
+
+void op_beat()
+{
+    static uint8_t beat_step;
+    static uint8_t beat_tick;
+    
+    play_packed_anim(&anim_beat, &beat_step, &beat_tick);
+}
+
+
+//op_cell_end 是同一组帧倒序播放
+const uint8_t cell_hold[] = {2, 2, 2, 2, 2};
+const uint8_t cell_data[] = {
+    0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111,
+    0b11111111, 0b01111111, 0b11111111, 0b01111111, 0b11111111, 0b01111111, 0b11111111, 0b01111111,
+    0b11111111, 0b00110011, 0b11111111, 0b00110011, 0b11111111, 0b00110011, 0b11111111, 0b00110011,
+    0b10011111, 0b10011001, 0b10011111, 0b10011001, 0b10011111, 0b10011001, 0b10011111, 0b10011001,
+    0b11001100, 0b11111111, 0b11001100, 0b11111111, 0b11001100, 0b11111111, 0b11001100, 0b11111111,
+};
+const sym_anim_t anim_cell_start = {SYM_X | SYM_Y | SYM_Z, 5, cell_hold, cell_data};
+const sym_anim_t anim_cell_end = {SYM_X | SYM_Y | SYM_Z | SYM_REVERSE, 5, cell_hold, cell_data};
+
+void op_cell_start()
+{
+    static uint8_t cell_start_frame;
+    static uint8_t cell_start_tick;
+    
+    play_sym_anim(&anim_cell_start, &cell_start_frame, &cell_start_tick);
+}
+
+//整帧放在闪存里直接扫描输出, 每层 z 相同
+const uint8_t cell_rotate_hold[] = {1, 1, 1, 1, 1, 2};
+const uint8_t cell_rotate_data[] = {
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b00111100, 0b00111100, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b00111100, 0b00111100,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b10011111, 0b10011100, 0b11111100, 0b11111111, 0b11111111, 0b00111111, 0b00111001, 0b11111001,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11001111, 0b11001111, 0b11111100, 0b11111100, 0b00111111, 0b00111111, 0b11110011, 0b11110011,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11100111, 0b11100111, 0b11111111, 0b00111100, 0b00111100, 0b11111111, 0b11100111, 0b11100111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11110011, 0b11110011, 0b00111111, 0b00111111, 0b11111100, 0b11111100, 0b11001111, 0b11001111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+    0b11111001, 0b00111001, 0b00111111, 0b11111111, 0b11111111, 0b11111100, 0b10011100, 0b10011111,
+};
+const flash_anim_t anim_cell_rotate = {6, cell_rotate_hold, cell_rotate_data};
+
+void op_cell_rotate()
+{
+    static uint8_t cell_rotate_frame;
+    static uint8_t cell_rotate_tick;
+    
+    play_flash_anim(&anim_cell_rotate, &cell_rotate_frame, &cell_rotate_tick);
+}
+
+void op_cell_end()
+{
+    static uint8_t cell_end_frame;
+    static uint8_t cell_end_tick;
+    
+    play_sym_anim(&anim_cell_end, &cell_end_frame, &cell_end_tick);
+}
+#endif
+
+
+void op_shell()
+{
+    uint8_t y, z, lo, hi;
+    row_t line;
+    static uint8_t shell_idx;
+    
+    if (show_start)
+        shell_idx = 0;
+    //从中心长到整个立方体再缩回
+    if (shell_idx < CUBE_SIZE / 2)
+        lo = CUBE_SIZE / 2 - 1 - shell_idx;
+    else
+        lo = shell_idx - CUBE_SIZE / 2;
+    hi = CUBE_SIZE - 1 - lo;
+    line = (row_t)~((ROW_FULL >> (CUBE_SIZE - (hi - lo + 1))) << lo);
+    
+    for (z = 0; z < CUBE_SIZE; ++z)
+    {
+        for (y = 0; y < CUBE_SIZE; ++y)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b11000011);
-            }
+            if (y >= lo && y <= hi && z >= lo && z <= hi)
+                choose_line(y, z, line);
+            else
+                choose_line(y, z, ROW_FULL);
         }
     }
-    else if (cell_end_idx < 4)
+    
+    if (++shell_idx >= CUBE_SIZE)
+        shell_idx = 0;
+}
+
+
+//一个周期 64 点的正弦表, 0..255, 中心 128
+const uint8_t sin_table[64] = {
+    128, 140, 153, 165, 177, 188, 199, 209,
+    218, 226, 234, 240, 245, 250, 253, 254,
+    255, 254, 253, 250, 245, 240, 234, 226,
+    218, 209, 199, 188, 177, 165, 153, 140,
+    128, 116, 103, 91, 79, 68, 57, 47,
+    38, 30, 22, 16, 11, 6, 3, 2,
+    1, 2, 3, 6, 11, 16, 22, 30,
+    38, 47, 57, 68, 79, 91, 103, 116,
+};
+
+//x/y 平面上到中心的距离 (1/8 体素), 按象限内的偏移 [dy][dx] 查表, 最大支持 16x16
+const uint8_t dist_table[8][8] = {
+    { 6, 13, 20, 28, 36, 44, 52, 60},
+    {13, 17, 23, 30, 38, 46, 53, 61},
+    {20, 23, 28, 34, 41, 48, 56, 63},
+    {28, 30, 34, 40, 46, 52, 59, 66},
+    {36, 38, 41, 46, 51, 57, 63, 70},
+    {44, 46, 48, 52, 57, 62, 68, 74},
+    {52, 53, 56, 59, 63, 68, 74, 79},
+    {60, 61, 63, 66, 70, 74, 79, 85},
+};
+
+#define fx_sin(p) (sin_table[(uint8_t)(p) & 63])
+#define fx_half(v) ((v) < CUBE_SIZE / 2 ? CUBE_SIZE / 2 - 1 - (v) : (v) - CUBE_SIZE / 2)
+#define fx_layer(h) ((h) >> (8 - LAYER_BITS)) //0..255 映射到层号
+
+//把一列 y 的高度 h[x] 画成一层一行的表面, 每行只写一次
+void fx_height_rows(uint8_t y, const uint8_t *h)
+{
+    uint8_t x, z;
+    row_t rows[CUBE_SIZE];
+    
+    memset(rows, 0, sizeof(rows));
+    for (x = 0; x < CUBE_SIZE; ++x)
+        rows[fx_layer(h[x])] |= (row_t)1 << x;
+    for (z = 0; z < CUBE_SIZE; ++z)
+        choose_line(y, z, (row_t)~rows[z]);
+}
+
+void fx_wave()
+{
+    uint8_t x, y, sy;
+    uint8_t sx[CUBE_SIZE];
+    uint8_t h[CUBE_SIZE];
+    static uint8_t wave_t;
+    
+    if (show_start) //每段从同一相位开始, 多块同步时中途换上的段也一致
+        wave_t = 0;
+    //两个方向的正弦相加, x 方向的值每帧只算一次
+    for (x = 0; x < CUBE_SIZE; ++x)
+        sx[x] = fx_sin(x * (64 / CUBE_SIZE) + wave_t) >> 1;
+    for (y = 0; y < CUBE_SIZE; ++y)
     {
-        for (y=0;y<1;y++)
+        sy = fx_sin(y * (64 / CUBE_SIZE) + wave_t * 2) >> 1;
+        for (x = 0; x < CUBE_SIZE; ++x)
+            h[x] = sx[x] + sy;
+        fx_height_rows(y, h);
+    }
+    wave_t += 2;
+}
+
+void fx_ripple()
+{
+    uint8_t x, y, dy;
+    uint8_t h[CUBE_SIZE];
+    static uint8_t ripple_t;
+    
+    if (show_start)
+        ripple_t = 0;
+    for (y = 0; y < CUBE_SIZE; ++y)
+    {
+        dy = fx_half(y);
+        for (x = 0; x < CUBE_SIZE; ++x)
+            h[x] = fx_sin(dist_table[dy][fx_half(x)] * 2 - ripple_t);
+        fx_height_rows(y, h);
+    }
+    ripple_t += 3;
+}
+
+void fx_plasma()
+{
+    uint8_t x, y, z, sz;
+    uint16_t base, v;
+    uint8_t sx[CUBE_SIZE];
+    row_t line;
+    static uint8_t plasma_t;
+    
+    if (show_start)
+        plasma_t = 0;
+    //三个方向的正弦和, 每行只算一次 y/z 部分, 逐 x 累加后取等值带
+    for (x = 0; x < CUBE_SIZE; ++x)
+        sx[x] = fx_sin(x * (56 / CUBE_SIZE) + plasma_t * 2);
+    for (z = 0; z < CUBE_SIZE; ++z)
+    {
+        sz = fx_sin(z * (48 / CUBE_SIZE) + plasma_t);
+        for (y = 0; y < CUBE_SIZE; ++y)
         {
-            for (z=0;z<8;z++)
+            base = sz + fx_sin(y * (40 / CUBE_SIZE) - plasma_t);
+            line = ROW_FULL;
+            for (x = 0; x < CUBE_SIZE; ++x)
             {
-                choose_line(y,z,~0b00000000);
+                v = base + sx[x];
+                if (v & 0b01000000)
+                    line &= ~((row_t)1 << x);
             }
+            choose_line(y, z, line);
         }
-        for (y=1;y<7;y++)
+    }
+    ++plasma_t;
+}
+
+
+//xorshift16 (7, 9, 8)
+uint8_t fx_rand()
+{
+    fx_rand_state ^= fx_rand_state << 7;
+    fx_rand_state ^= fx_rand_state >> 9;
+    fx_rand_state ^= fx_rand_state << 8;
+    return (uint8_t)fx_rand_state;
+}
+
+//整个 draw_buffer 沿一个轴移动一格, 空出的位置为暗
+void shift_buffer(uint8_t axis, uint8_t up)
+{
+    uint8_t z;
+    buf_idx_t i;
+    row_t r;
+    
+    if (axis == axis_z) //层之间整块移动
+    {
+        if (up)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b01100110);
-            }
+            memmove(draw_buffer + LAYER_SIZE, draw_buffer, BUF_SIZE - LAYER_SIZE);
+            memset(draw_buffer, 0b11111111, LAYER_SIZE);
         }
-        for (y=7;y<8;y++)
+        else
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            memmove(draw_buffer, draw_buffer + LAYER_SIZE, BUF_SIZE - LAYER_SIZE);
+            memset(draw_buffer + BUF_SIZE - LAYER_SIZE, 0b11111111, LAYER_SIZE);
         }
     }
-    else if (cell_end_idx < 6)
+    else if (axis == axis_y) //每层内的行移动
     {
-        for (y=0;y<2;y++)
+        for (z = 0; z < CUBE_SIZE; ++z)
         {
-            for (z=0;z<8;z++)
+            i = z * LAYER_SIZE;
+            if (up)
             {
-                choose_line(y,z,~0b00000000);
+                memmove(draw_buffer + i + ROW_BYTES, draw_buffer + i, LAYER_SIZE - ROW_BYTES);
+                memset(draw_buffer + i, 0b11111111, ROW_BYTES);
             }
-        }
-        for (y=2;y<6;y++)
-        {
-            for (z=0;z<8;z++)
+            else
             {
-                choose_line(y,z,~0b00111100);
-            }
-        }
-        for (y=6;y<8;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
+                memmove(draw_buffer + i, draw_buffer + i + ROW_BYTES, LAYER_SIZE - ROW_BYTES);
+                memset(draw_buffer + i + LAYER_SIZE - ROW_BYTES, 0b11111111, ROW_BYTES);
             }
         }
     }
-    else if (cell_end_idx < 8)
+    else //行内移位, 低电平为亮, 移入 1
     {
-        for (y=0;y<3;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
-        }
-        for (y=3;y<5;y++)
-        {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00011000);
-            }
+        for (i = 0; i < BUF_SIZE; i += ROW_BYTES)
+        {
+#if ROW_BYTES > 1
+            r = draw_buffer[i] | ((row_t)draw_buffer[i + 1] << 8);
+#else
+            r = draw_buffer[i];
+#endif
+            if (up)
+                r = (row_t)(r << 1) | 1;
+            else
+                r = (r >> 1) | ((row_t)1 << (CUBE_SIZE - 1));
+            draw_buffer[i] = (uint8_t)r;
+#if ROW_BYTES > 1
+            draw_buffer[i + 1] = (uint8_t)(r >> 8);
+#endif
         }
-        for (y=5;y<8;y++)
+    }
+    mark_dirty_all();
+}
+
+//雨滴从顶层 (z 最大) 落下
+void fx_rain_step(uint8_t density)
+{
+    uint8_t x, y;
+    
+    shift_buffer(axis_z, 0);
+    for (y = 0; y < CUBE_SIZE; ++y)
+        for (x = 0; x < CUBE_SIZE; ++x)
+            if (fx_rand() < density)
+                choose_led(x, y, CUBE_SIZE - 1, led_up);
+}
+
+//星星从远处 (y 最大) 向 y=0 飞来
+void fx_star_step(uint8_t density)
+{
+    uint8_t x, z;
+    
+    shift_buffer(axis_y, 0);
+    for (z = 0; z < CUBE_SIZE; ++z)
+        for (x = 0; x < CUBE_SIZE; ++x)
+            if (fx_rand() < density)
+                choose_led(x, CUBE_SIZE - 1, z, led_up);
+}
+
+//每步熄灭全部, 再随机点亮 density/8 个左右的体素
+void fx_sparkle_step(uint8_t density)
+{
+    uint8_t n;
+    
+    memset(draw_buffer, 0b11111111, BUF_SIZE);
+    mark_dirty_all();
+    for (n = density >> 3; n; --n)
+        choose_led(fx_rand() & (CUBE_SIZE - 1), fx_rand() & (CUBE_SIZE - 1), fx_rand() & (CUBE_SIZE - 1), led_up);
+}
+
+const fast_fx_t fast_rain = {fx_rain_step, 20, 4};
+const fast_fx_t fast_starfield = {fx_star_step, 8, 2};
+const fast_fx_t fast_sparkle = {fx_sparkle_step, 96, 3};
+
+void fx_rain()
+{
+    fast_fx = &fast_rain;
+}
+
+void fx_starfield()
+{
+    fast_fx = &fast_starfield;
+}
+
+void fx_sparkle()
+{
+    fast_fx = &fast_sparkle;
+}
+
+
+#if BAR_ENABLE
+//高度 h 的柱在第 z 层亮, 当且仅当 h > z
+void fx_bars_step(uint8_t density)
+{
+    uint8_t i, x, y, z, h, changed;
+    uint8_t *cur;
+    const uint8_t *target;
+    row_t acc;
+    row_t level[CUBE_SIZE + 1]; //level[h]: 这一行 y 中高度为 h 的柱
+    
+    changed = bar_ready;
+    bar_ready = 0;
+    cur = bar_cur;
+    target = bar_target;
+    for (i = 0; i < ROW_NUM; ++i, ++cur, ++target)
+    {
+        h = *target << 4;
+        if (bar_mode == bar_decay && h < *cur)
+            h = *cur - 2 > h ? *cur - 2 : h;
+        else if (bar_mode == bar_smooth && h != *cur)
+            h = (h > *cur) ? *cur + ((h - *cur + 3) >> 2) : *cur - ((*cur - h + 3) >> 2);
+        if (h != *cur)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            *cur = h;
+            changed = 1;
         }
     }
-    else if (cell_end_idx < 10)
+    if (!changed)
+        return;
+    
+    cur = bar_cur;
+    for (y = 0; y < CUBE_SIZE; ++y)
     {
-        for (y=0;y<8;y++)
+        memset(level, 0, sizeof(level));
+        for (x = 0; x < CUBE_SIZE; ++x)
+            level[(*cur++ + 8) >> 4] |= (row_t)1 << x;
+        
+        //从顶层往下累加, 每层的行就是所有更高的柱
+        acc = 0;
+        for (z = CUBE_SIZE; z > 0; --z)
         {
-            for (z=0;z<8;z++)
-            {
-                choose_line(y,z,~0b00000000);
-            }
+            acc |= level[z];
+            choose_line(y, z - 1, (row_t)~acc);
         }
     }
-    
-    if(++cell_end_idx >= 10)
-        cell_end_idx = 0;
 }
+
+const fast_fx_t fast_bars = {fx_bars_step, 0, 8};
+
+void fx_bars()
+{
+    fast_fx = &fast_bars;
+}
+#endif
@@ -0,0 +1,497 @@
+/*
+ * cubec - 光立方动画编译器 (主机端)
+ *
+ * 把文本场景描述编译成 main.c 里 play_sym_anim() 使用的 sym_anim_t 表,
+ * 自动检测每个动画在 x/y/z 方向的镜像对称, 只保存必要的部分.
+ *
+ *   cc -O2 -o cubec tools/cubec.c
+ *   cubec scene.txt -o anims.h        生成头文件, 统计信息输出到 stderr
+ *   cubec scene.txt -p                打印每一帧
+ *   cubec scene.txt -d frames.txt     按 display_buffer 格式逐帧输出十六进制和 hold, 便于 diff
+ *
+ * 生成的表是否与场景一致, 以及 draw_sym_frame() 每帧的周期数, 由 scansim -f 用固件代码
+ * 实际播放生成的头文件来核对和测量 (见 tools/scansim/scansim.c).
+ *
+ * 场景语法 (每行一条命令, # 之后为注释, 坐标 0..7):
+ *   anim NAME                  开始一个动画
+ *   frame TICKS [clear]        新的一帧, 持续 TICKS 次 timer0; 默认沿用上一帧内容
+ *   clear | fill | invert
+ *   voxel X Y Z [off]
+ *   box X0 Y0 Z0 X1 Y1 Z1 [off]       实心长方体
+ *   shell X0 Y0 Z0 X1 Y1 Z1 [off]     空心长方体表面
+ *   sphere CX CY CZ R [off]           球面 (允许小数, 中心为 3.5)
+ *   row Y Z BITS                       整行, BITS 写法同 0b 字面量, 1 为亮, 最右为 x=0
+ *   shift DX DY DZ | rotate x|y|z | mirror x|y|z    对当前帧做变换
+ *   repeat N TICKS CMD...              连续生成 N 帧, 每帧在上一帧上执行 CMD
+ *   end
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define CUBE 8
+#define FRAME_SIZE (CUBE * CUBE)
+#define MAX_FRAMES 255
+#define MAX_ANIMS 32
+
+#define SYM_X 0x01
+#define SYM_Y 0x02
+#define SYM_Z 0x04
+
+typedef struct {
+    uint8_t lit[FRAME_SIZE]; /* 行号 z*8+y, 位 x, 1 为亮 */
+    uint8_t hold;
+} frame_t;
+
+typedef struct {
+    char name[64];
+    int frames;
+    frame_t frame[MAX_FRAMES];
+} anim_t;
+
+static anim_t anims[MAX_ANIMS];
+static int anim_num;
+static int line_no;
+static const char *src_name;
+
+static void fail(const char *msg)
+{
+    fprintf(stderr, "%s:%d: %s\n", src_name, line_no, msg);
+    exit(1);
+}
+
+static int coord(const char *s)
+{
+    char *end;
+    long v = strtol(s, &end, 0);
+    if (*end || v < 0 || v >= CUBE)
+        fail("coordinate out of range");
+    return (int)v;
+}
+
+static void set_voxel(frame_t *f, int x, int y, int z, int on)
+{
+    if (on)
+        f->lit[z * CUBE + y] |= (uint8_t)(1 << x);
+    else
+        f->lit[z * CUBE + y] &= (uint8_t)~(1 << x);
+}
+
+static int get_voxel(const frame_t *f, int x, int y, int z)
+{
+    return (f->lit[z * CUBE + y] >> x) & 1;
+}
+
+static void transform(frame_t *f, char **arg, int argc)
+{
+    frame_t t;
+    int x, y, z;
+
+    memset(&t, 0, sizeof(t));
+    if (!strcmp(arg[0], "shift") && argc == 4)
+    {
+        int dx = atoi(arg[1]), dy = atoi(arg[2]), dz = atoi(arg[3]);
+        for (z = 0; z < CUBE; ++z)
+            for (y = 0; y < CUBE; ++y)
+                for (x = 0; x < CUBE; ++x)
+                {
+                    int nx = x + dx, ny = y + dy, nz = z + dz;
+                    if (nx < 0 || ny < 0 || nz < 0 || nx >= CUBE || ny >= CUBE || nz >= CUBE)
+                        continue;
+                    set_voxel(&t, nx, ny, nz, get_voxel(f, x, y, z));
+                }
+    }
+    else if ((!strcmp(arg[0], "rotate") || !strcmp(arg[0], "mirror")) && argc == 2)
+    {
+        int rot = !strcmp(arg[0], "rotate");
+        char axis = arg[1][0];
+        if (axis != 'x' && axis != 'y' && axis != 'z')
+            fail("axis must be x, y or z");
+        for (z = 0; z < CUBE; ++z)
+            for (y = 0; y < CUBE; ++y)
+                for (x = 0; x < CUBE; ++x)
+                {
+                    int nx = x, ny = y, nz = z;
+                    if (rot && axis == 'z') { nx = CUBE - 1 - y; ny = x; }
+                    if (rot && axis == 'y') { nx = z; nz = CUBE - 1 - x; }
+                    if (rot && axis == 'x') { ny = CUBE - 1 - z; nz = y; }
+                    if (!rot && axis == 'x') nx = CUBE - 1 - x;
+                    if (!rot && axis == 'y') ny = CUBE - 1 - y;
+                    if (!rot && axis == 'z') nz = CUBE - 1 - z;
+                    set_voxel(&t, nx, ny, nz, get_voxel(f, x, y, z));
+                }
+    }
+    else
+    {
+        fail("unknown transform");
+    }
+    memcpy(f->lit, t.lit, FRAME_SIZE);
+}
+
+/* 在当前帧上执行一条绘图或变换命令 */
+static void draw(frame_t *f, char **arg, int argc)
+{
+    int x, y, z, on;
+
+    on = !(argc > 1 && !strcmp(arg[argc - 1], "off"));
+    if (!on)
+        --argc;
+
+    if (!strcmp(arg[0], "clear") || !strcmp(arg[0], "fill"))
+    {
+        memset(f->lit, arg[0][0] == 'f' ? 0xFF : 0, FRAME_SIZE);
+    }
+    else if (!strcmp(arg[0], "invert"))
+    {
+        for (y = 0; y < FRAME_SIZE; ++y)
+            f->lit[y] = (uint8_t)~f->lit[y];
+    }
+    else if (!strcmp(arg[0], "voxel") && argc == 4)
+    {
+        set_voxel(f, coord(arg[1]), coord(arg[2]), coord(arg[3]), on);
+    }
+    else if ((!strcmp(arg[0], "box") || !strcmp(arg[0], "shell")) && argc == 7)
+    {
+        int x0 = coord(arg[1]), y0 = coord(arg[2]), z0 = coord(arg[3]);
+        int x1 = coord(arg[4]), y1 = coord(arg[5]), z1 = coord(arg[6]);
+        int hollow = arg[0][0] == 's';
+        for (z = z0; z <= z1; ++z)
+            for (y = y0; y <= y1; ++y)
+                for (x = x0; x <= x1; ++x)
+                {
+                    if (hollow && x != x0 && x != x1 && y != y0 && y != y1 && z != z0 && z != z1)
+                        continue;
+                    set_voxel(f, x, y, z, on);
+                }
+    }
+    else if (!strcmp(arg[0], "sphere") && argc == 5)
+    {
+        double cx = atof(arg[1]), cy = atof(arg[2]), cz = atof(arg[3]), r = atof(arg[4]);
+        for (z = 0; z < CUBE; ++z)
+            for (y = 0; y < CUBE; ++y)
+                for (x = 0; x < CUBE; ++x)
+                {
+                    double d = sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy) + (z - cz) * (z - cz));
+                    if (fabs(d - r) <= 0.5)
+                        set_voxel(f, x, y, z, on);
+                }
+    }
+    else if (!strcmp(arg[0], "row") && argc == 4)
+    {
+        const char *bits = arg[3];
+        unsigned v = 0;
+        if (!strncmp(bits, "0b", 2))
+            bits += 2;
+        if (strlen(bits) != CUBE || strspn(bits, "01") != CUBE)
+            fail("row needs 8 binary digits");
+        for (; *bits; ++bits)
+            v = (v << 1) | (unsigned)(*bits - '0');
+        f->lit[coord(arg[2]) * CUBE + coord(arg[1])] = (uint8_t)v;
+    }
+    else
+    {
+        transform(f, arg, argc);
+    }
+}
+
+static anim_t *cur_anim(void)
+{
+    if (anim_num == 0 || anims[anim_num - 1].name[0] == 0)
+        fail("command outside of anim ... end");
+    return &anims[anim_num - 1];
+}
+
+static frame_t *new_frame(int hold, int clear)
+{
+    anim_t *a = cur_anim();
+    frame_t *f;
+
+    if (a->frames >= MAX_FRAMES)
+        fail("too many frames");
+    if (hold < 1 || hold > 255)
+        fail("hold must be 1..255 ticks");
+    f = &a->frame[a->frames];
+    if (a->frames > 0 && !clear)
+        memcpy(f->lit, a->frame[a->frames - 1].lit, FRAME_SIZE);
+    else
+        memset(f->lit, 0, FRAME_SIZE);
+    f->hold = (uint8_t)hold;
+    ++a->frames;
+    return f;
+}
+
+static void parse(FILE *in)
+{
+    char line[512];
+    char *arg[16];
+    int argc, open = 0;
+
+    while (fgets(line, sizeof(line), in))
+    {
+        char *p = strchr(line, '#');
+        ++line_no;
+        if (p)
+            *p = 0;
+        argc = 0;
+        for (p = strtok(line, " \t\r\n"); p && argc < 16; p = strtok(NULL, " \t\r\n"))
+            arg[argc++] = p;
+        if (argc == 0)
+            continue;
+
+        if (!strcmp(arg[0], "anim") && argc == 2)
+        {
+            if (open)
+                fail("missing end");
+            if (anim_num >= MAX_ANIMS)
+                fail("too many animations");
+            memset(&anims[anim_num], 0, sizeof(anim_t));
+            snprintf(anims[anim_num].name, sizeof(anims[anim_num].name), "%s", arg[1]);
+            ++anim_num;
+            open = 1;
+        }
+        else if (!strcmp(arg[0], "end"))
+        {
+            if (!open || cur_anim()->frames == 0)
+                fail("end without frames");
+            open = 0;
+        }
+        else if (!open)
+        {
+            fail("command outside of anim ... end");
+        }
+        else if (!strcmp(arg[0], "frame") && argc >= 2)
+        {
+            new_frame(atoi(arg[1]), argc > 2 && !strcmp(arg[2], "clear"));
+        }
+        else if (!strcmp(arg[0], "repeat") && argc >= 4)
+        {
+            int n = atoi(arg[1]), hold = atoi(arg[2]), i;
+            if (cur_anim()->frames == 0)
+                fail("repeat needs a previous frame");
+            for (i = 0; i < n; ++i)
+                draw(new_frame(hold, 0), arg + 3, argc - 3);
+        }
+        else
+        {
+            anim_t *a = cur_anim();
+            if (a->frames == 0)
+                fail("drawing before the first frame");
+            draw(&a->frame[a->frames - 1], arg, argc);
+        }
+    }
+    if (open)
+        fail("missing end");
+}
+
+static uint8_t rev8(uint8_t b)
+{
+    uint8_t r = 0;
+    int i;
+    for (i = 0; i < 8; ++i)
+        if (b & (1 << i))
+            r |= (uint8_t)(0x80 >> i);
+    return r;
+}
+
+static int detect_sym(const anim_t *a)
+{
+    int sym = SYM_X | SYM_Y | SYM_Z, i, y, z;
+
+    for (i = 0; i < a->frames; ++i)
+    {
+        const uint8_t *f = a->frame[i].lit;
+        for (z = 0; z < CUBE; ++z)
+            for (y = 0; y < CUBE; ++y)
+            {
+                if (rev8(f[z * CUBE + y]) != f[z * CUBE + y])
+                    sym &= ~SYM_X;
+                if (f[z * CUBE + y] != f[z * CUBE + CUBE - 1 - y])
+                    sym &= ~SYM_Y;
+                if (f[z * CUBE + y] != f[(CUBE - 1 - z) * CUBE + y])
+                    sym &= ~SYM_Z;
+            }
+    }
+    return sym;
+}
+
+static int frame_bytes(int sym)
+{
+    int n = ((sym & SYM_Y) ? 4 : 8) * ((sym & SYM_Z) ? 4 : 8);
+    return (sym & SYM_X) ? n / 2 : n;
+}
+
+/* 与固件相同的存储顺序: z 外层, y 内层, x 对称时两行拼一个字节 (偶数行在低 4 位) */
+static void encode(const uint8_t *lit, int sym, uint8_t *out)
+{
+    int ny = (sym & SYM_Y) ? 4 : 8, nz = (sym & SYM_Z) ? 4 : 8, y, z, n = 0;
+
+    for (z = 0; z < nz; ++z)
+        for (y = 0; y < ny; ++y)
+        {
+            uint8_t row = (uint8_t)~lit[z * CUBE + y];
+            if (sym & SYM_X)
+            {
+                if (y & 1)
+                    out[n++] |= (uint8_t)((row & 0x0F) << 4);
+                else
+                    out[n] = row & 0x0F;
+            }
+            else
+            {
+                out[n++] = row;
+            }
+        }
+}
+
+static const char *sym_name(int sym)
+{
+    static char buf[48];
+    buf[0] = 0;
+    if (sym & SYM_X) strcat(buf, "SYM_X | ");
+    if (sym & SYM_Y) strcat(buf, "SYM_Y | ");
+    if (sym & SYM_Z) strcat(buf, "SYM_Z | ");
+    if (buf[0])
+        buf[strlen(buf) - 3] = 0;
+    else
+        strcpy(buf, "0");
+    return buf;
+}
+
+static void emit(FILE *out, const anim_t *a, int sym)
+{
+    int size = frame_bytes(sym), i, j;
+    uint8_t data[FRAME_SIZE];
+
+    fprintf(out, "const uint8_t %s_hold[] = {", a->name);
+    for (i = 0; i < a->frames; ++i)
+        fprintf(out, "%s%d", i ? ", " : "", a->frame[i].hold);
+    fprintf(out, "};\nconst uint8_t %s_data[] = {\n", a->name);
+    for (i = 0; i < a->frames; ++i)
+    {
+        encode(a->frame[i].lit, sym, data);
+        for (j = 0; j < size; ++j)
+        {
+            int b;
+            fprintf(out, "%s0b", (j % 8) ? " " : "    ");
+            for (b = 7; b >= 0; --b)
+                fputc('0' + ((data[j] >> b) & 1), out);
+            fputc(',', out);
+            if (j % 8 == 7 || j == size - 1)
+                fputc('\n', out);
+        }
+    }
+    fprintf(out, "};\nconst sym_anim_t anim_%s = {%s, %d, %s_hold, %s_data};\n\n",
+            a->name, sym_name(sym), a->frames, a->name, a->name);
+}
+
+static void preview(FILE *out, const anim_t *a, int f, const uint8_t *buf)
+{
+    int y, z, x;
+
+    fprintf(out, "%s frame %d (hold %d)\n", a->name, f, a->frame[f].hold);
+    for (y = CUBE - 1; y >= 0; --y)
+    {
+        for (z = 0; z < CUBE; ++z)
+        {
+            for (x = 0; x < CUBE; ++x)
+                fputc((buf[z * CUBE + y] >> x) & 1 ? '.' : '#', out);
+            fputs(z == CUBE - 1 ? "\n" : "  ", out);
+        }
+    }
+    fputc('\n', out);
+}
+
+int main(int argc, char **argv)
+{
+    const char *in_name = NULL, *out_name = NULL, *dump_name = NULL;
+    int show = 0, i, f;
+    long total = 0, total_raw = 0;
+    FILE *in, *out = NULL, *dump = NULL;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_name = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            dump_name = argv[++i];
+        else if (!strcmp(argv[i], "-p"))
+            show = 1;
+        else if (!in_name)
+            in_name = argv[i];
+        else
+            in_name = NULL, i = argc;
+    }
+    if (!in_name)
+    {
+        fprintf(stderr, "usage: cubec scene.txt [-o anims.h] [-p] [-d frames.txt]\n");
+        return 2;
+    }
+
+    src_name = in_name;
+    in = strcmp(in_name, "-") ? fopen(in_name, "r") : stdin;
+    if (!in)
+    {
+        perror(in_name);
+        return 1;
+    }
+    parse(in);
+
+    if (out_name && !(out = fopen(out_name, "w")))
+    {
+        perror(out_name);
+        return 1;
+    }
+    if (dump_name && !(dump = fopen(dump_name, "w")))
+    {
+        perror(dump_name);
+        return 1;
+    }
+    if (out)
+        fprintf(out, "/* generated by cubec from %s, do not edit */\n\n", in_name);
+
+    fprintf(stderr, "%-16s %6s %-21s %6s %6s\n", "anim", "frames", "symmetry", "flash", "raw");
+    for (i = 0; i < anim_num; ++i)
+    {
+        const anim_t *a = &anims[i];
+        int sym = detect_sym(a), size = frame_bytes(sym);
+        long bytes = (long)a->frames * (size + 1) + 6; /* 数据 + hold + sym_anim_t */
+
+        if (out)
+            emit(out, a, sym);
+        for (f = 0; f < a->frames; ++f)
+        {
+            uint8_t buf[FRAME_SIZE];
+            int k;
+            for (k = 0; k < FRAME_SIZE; ++k)
+                buf[k] = (uint8_t)~a->frame[f].lit[k]; /* display_buffer 低电平为亮 */
+            if (show)
+                preview(stdout, a, f, buf);
+            if (dump)
+            {
+                for (k = 0; k < FRAME_SIZE; ++k)
+                    fprintf(dump, "%02x", buf[k]);
+                fprintf(dump, " %s %d %d\n", a->name, f, a->frame[f].hold);
+            }
+        }
+        fprintf(stderr, "%-16s %6d %-21s %6ld %6d\n", a->name, a->frames, sym_name(sym),
+                bytes, a->frames * FRAME_SIZE);
+        total += bytes;
+        total_raw += (long)a->frames * FRAME_SIZE;
+    }
+    fprintf(stderr, "%-16s %6s %-21s %6ld %6ld\n", "total", "", "", total, total_raw);
+
+    if (out)
+    {
+        /* 供 scansim -DCUBEC_HEADER 逐个播放 */
+        fprintf(out, "#define CUBEC_ANIMS");
+        for (i = 0; i < anim_num; ++i)
+            fprintf(out, " CUBEC_ANIM(%s)", anims[i].name);
+        fprintf(out, "\n");
+        fclose(out);
+    }
+    if (dump)
+        fclose(dump);
+    return 0;
+}
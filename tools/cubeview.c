@@ -0,0 +1,175 @@
+/*
+ * cubeview - 光立方实时预览 (主机端)
+ *
+ * 接收 main.c 在 PREVIEW_ENABLE 为 1 时从 TX (RB6) 发出的增量帧, 还原出固件
+ * 正在显示的画面并在终端里刷新, 用于现场远程调试.
+ *
+ *   cc -O2 -o cubeview tools/cubeview.c
+ *   cubeview /dev/ttyUSB0             打开串口 (38400 8N1) 实时显示
+ *   cubeview -l /dev/ttyUSB0          不清屏, 每包打印一次, 便于保存日志
+ *   cubeview -s 4 /dev/ttyUSB0        固件的 CUBE_SIZE 不是 8 时给出边长 (1..8, 有 EUSART 的尺寸)
+ *   cubeview - < capture.bin          回放用其他工具录下的原始字节流
+ *
+ * 包格式: 0xD0|整帧, 序号, 若干 (字节序号, 数据), 0xFF, 校验
+ * 校验为序号到 0xFF 之间所有字节的异或. 收到第一个整帧之前画面未同步.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define CUBE_MAX 8 /* 16x16x16 没有 EUSART, 不会有预览 */
+#define FRAME_MAX (CUBE_MAX * CUBE_MAX)
+
+#define PREVIEW_SYNC 0xD0
+#define PREVIEW_END 0xFF
+
+enum { st_sync, st_seq, st_index, st_data, st_check };
+
+static int cube = 8, frame_size = FRAME_MAX; /* 与固件的 CUBE_SIZE, BUF_SIZE 相同 */
+static uint8_t mirror[FRAME_MAX]; /* 与 display_buffer 相同, 行号 z*cube+y, 低电平为亮 */
+static uint8_t pend_idx[FRAME_MAX], pend_val[FRAME_MAX];
+static int synced;
+static long packets, bad_sum, lost;
+
+static int open_serial(const char *name)
+{
+    struct termios tio;
+    int fd;
+
+    if (!strcmp(name, "-"))
+        return 0;
+    if ((fd = open(name, O_RDONLY | O_NOCTTY)) < 0)
+    {
+        perror(name);
+        exit(1);
+    }
+    if (tcgetattr(fd, &tio) == 0) /* 普通文件没有终端属性, 直接读 */
+    {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B38400);
+        cfsetospeed(&tio, B38400);
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static void show(FILE *out, int log, int seq, int key, int changed)
+{
+    int y, z, x;
+
+    if (!log)
+        fputs("\033[H\033[J", out);
+    fprintf(out, "seq %3d %s %2d bytes  packets %ld  bad %ld  lost %ld%s\n",
+            seq, key ? "key  " : "delta", changed, packets, bad_sum, lost,
+            synced ? "" : "  (waiting for key frame)");
+    for (y = cube - 1; y >= 0; --y)
+    {
+        for (z = 0; z < cube; ++z)
+        {
+            for (x = 0; x < cube; ++x)
+                fputc((mirror[z * cube + y] >> x) & 1 ? '.' : '#', out);
+            fputs(z == cube - 1 ? "\n" : "  ", out);
+        }
+    }
+    fputc('\n', out);
+    fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = NULL;
+    int log = 0, fd, i, j, n, state = st_sync;
+    int key = 0, seq = 0, last_seq = -1, count = 0;
+    uint8_t buf[256], b, sum = 0;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-l"))
+            log = 1;
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            cube = atoi(argv[++i]);
+        else if (!name)
+            name = argv[i];
+        else
+            name = NULL, i = argc;
+    }
+    if (!name || cube < 1 || cube > CUBE_MAX)
+    {
+        fprintf(stderr, "usage: cubeview [-l] [-s 1..8] DEVICE|-\n");
+        return 2;
+    }
+    frame_size = cube * cube;
+
+    fd = open_serial(name);
+    memset(mirror, 0xFF, sizeof(mirror));
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (i = 0; i < n; ++i)
+        {
+            b = buf[i];
+            switch (state)
+            {
+            case st_sync:
+                if ((b & 0xFE) == PREVIEW_SYNC)
+                {
+                    key = b & 1;
+                    sum = 0;
+                    count = 0;
+                    state = st_seq;
+                }
+                break;
+            case st_seq:
+                seq = b;
+                sum ^= b;
+                state = st_index;
+                break;
+            case st_index:
+                sum ^= b;
+                if (b == PREVIEW_END)
+                    state = st_check;
+                else if (b >= frame_size || count == frame_size)
+                    state = st_sync; /* 不是合法的包, 重新找包头 */
+                else
+                {
+                    pend_idx[count] = b;
+                    state = st_data;
+                }
+                break;
+            case st_data:
+                sum ^= b;
+                pend_val[count++] = b;
+                state = st_index;
+                break;
+            case st_check:
+                state = st_sync;
+                if (b != sum)
+                {
+                    ++bad_sum;
+                    synced = 0; /* 丢了一包增量, 等下一个整帧 */
+                    break;
+                }
+                if (last_seq >= 0 && seq != ((last_seq + 1) & 0xFF))
+                {
+                    lost += (seq - last_seq - 1) & 0xFF;
+                    synced = 0;
+                }
+                last_seq = seq;
+                ++packets;
+                if (key)
+                    synced = 1;
+                for (j = 0; j < count; ++j)
+                    mirror[pend_idx[j]] = pend_val[j];
+                show(stdout, log, seq, key, count);
+                break;
+            }
+        }
+    }
+    return 0;
+}
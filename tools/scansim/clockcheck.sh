@@ -0,0 +1,38 @@
+#!/bin/sh
+# 按 4/8/32MHz 分别编译 scansim 并运行, 比较刷新率和动画进度; 不一致时退出码为 1.
+# 默认配置和 RENDER_DEPTH=0 (主循环扫描) 各比一次, 其余参数作为固件配置传给编译器:
+#   tools/scansim/clockcheck.sh [-DCUBE_SIZE=4 ...]
+# 刷新率允许 1% 的差别 (整帧计数在运行结束时的取整), 播放位置必须完全相同.
+
+cd "$(dirname "$0")/../.." || exit 2
+CC=${CC:-cc}
+MS=${MS:-3000}
+TMP=${TMPDIR:-/tmp}/clockcheck.$$
+mkdir -p "$TMP" || exit 2
+trap 'rm -rf "$TMP"' EXIT
+
+fail=0
+for mode in "" "-DRENDER_DEPTH=0"; do
+    ref=
+    for freq in 4000000 8000000 32000000; do
+        bin="$TMP/scansim"
+        if ! $CC -O0 -fsanitize-coverage=trace-pc -w -Itools/scansim -D_XTAL_FREQ=$freq $mode "$@" \
+                -o "$bin" tools/scansim/scansim.c; then
+            echo "build failed: _XTAL_FREQ=$freq $mode $*"
+            exit 2
+        fi
+        "$bin" -t "$MS" -o /dev/null 2> "$TMP/out"
+        refresh=$(sed -n 's/.*refresh \([0-9.]*\) Hz.*/\1/p' "$TMP/out")
+        play=$(sed -n 's/^playlist item \([0-9]*\), tick \([0-9]*\),.*/\1.\2/p' "$TMP/out")
+        echo "_XTAL_FREQ=$freq ${mode:-default}: refresh $refresh Hz, playlist item.tick $play"
+        if [ -z "$ref" ]; then
+            ref=$refresh
+            ref_play=$play
+        elif ! awk -v a="$refresh" -v b="$ref" 'BEGIN { d = a - b; if (d < 0) d = -d; exit !(d <= b / 100) }' ||
+             [ "$play" != "$ref_play" ]; then
+            echo "  differs from 4MHz: refresh $ref Hz, playlist item.tick $ref_play"
+            fail=1
+        fi
+    done
+done
+exit $fail
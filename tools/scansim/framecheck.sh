@@ -0,0 +1,61 @@
+#!/bin/sh
+# 核对 sym_anim_t 动画的帧, 有不一致时退出码为 1:
+#   1. 每个场景文件用 cubec 生成头文件, 由 scansim -f 用固件的 play_sym_anim/draw_sym_frame 播放,
+#      与 cubec -d 直接输出的场景帧逐帧比较 (含 hold);
+#   2. main.c 自带的动画按播放顺序与同名场景比较. tools/scenes 里的场景由原来逐行画图的
+#      代码逐帧导出, 所以这一步确认对称存储的表画出的帧和节拍与原来完全相同.
+#   tools/scansim/framecheck.sh [scene.txt ...]      默认为 tools/scenes/*.txt
+# 最后打印 scansim 报告的闪存占用 (对比整帧存储) 和每帧周期数.
+
+cd "$(dirname "$0")/../.." || exit 2
+CC=${CC:-cc}
+TMP=${TMPDIR:-/tmp}/framecheck.$$
+mkdir -p "$TMP" || exit 2
+trap 'rm -rf "$TMP"' EXIT
+[ $# -gt 0 ] || set -- tools/scenes/*.txt
+
+build() # 输出文件, 其余为附加的编译参数
+{
+    out=$1
+    shift
+    if ! $CC -O0 -fsanitize-coverage=trace-pc -w -Itools/scansim "$@" -o "$out" tools/scansim/scansim.c; then
+        echo "build failed: $*"
+        exit 2
+    fi
+}
+
+$CC -O2 -o "$TMP/cubec" tools/cubec.c -lm || exit 2
+build "$TMP/builtin"
+"$TMP/builtin" -f 0 > "$TMP/builtin.txt" 2> "$TMP/builtin.log" || exit 2
+
+fail=0
+: > "$TMP/scenes.txt"
+for scene in "$@"; do
+    "$TMP/cubec" "$scene" -o "$TMP/anims.h" -d "$TMP/scene.txt" 2> /dev/null || { echo "$scene: cubec failed"; exit 2; }
+    build "$TMP/scansim" -I"$TMP" -DCUBEC_HEADER='"anims.h"'
+    "$TMP/scansim" -f 0 > "$TMP/played.txt" 2> /dev/null || exit 2
+    if diff "$TMP/scene.txt" "$TMP/played.txt" > "$TMP/diff"; then
+        echo "$scene: $(wc -l < "$TMP/scene.txt") frames played back by draw_sym_frame match"
+    else
+        echo "$scene: frames played back by draw_sym_frame differ:"
+        cat "$TMP/diff"
+        fail=1
+    fi
+    cat "$TMP/scene.txt" >> "$TMP/scenes.txt"
+done
+
+# 自带动画只和有同名场景的比较
+for name in $(awk '{ print $2 }' "$TMP/builtin.txt" | uniq); do
+    awk -v n="$name" '$2 == n' "$TMP/scenes.txt" > "$TMP/want.txt"
+    [ -s "$TMP/want.txt" ] || continue
+    awk -v n="$name" '$2 == n' "$TMP/builtin.txt" > "$TMP/got.txt"
+    if diff "$TMP/want.txt" "$TMP/got.txt" > "$TMP/diff"; then
+        echo "main.c anim_$name: same frames and holds as its scene"
+    else
+        echo "main.c anim_$name: differs from its scene:"
+        cat "$TMP/diff"
+        fail=1
+    fi
+done
+cat "$TMP/builtin.log"
+exit $fail
@@ -0,0 +1,1036 @@
+/*
+ * scansim - 扫描时序仿真 (主机端)
+ *
+ * 把 main.c 连同本目录的 xc.h 替身在主机上编译, 从 system_init() 开始运行固件,
+ * 把 PORTA 数据线, SHCP (RC0), STCP (RC1), OE (RC2) 和层选 (RC4 起) 的变化写成
+ * VCD 文件 (可用 GTKWave 打开), 并统计每层点亮时间, 移位耗时和消隐间隔; 换层代码的
+ * 实际周期数 (CCP1 唤醒到移完一层, 关 OE 到开 OE) 与 main.c 里的 SCAN_SHIFT_CYCLES,
+ * SCAN_GAP_CYCLES 对照, 这些常数按这里的结果设定.
+ *
+ *   cc -O0 -fsanitize-coverage=trace-pc -Itools/scansim -o scansim tools/scansim/scansim.c
+ *   scansim [-t MS] [-o scan.vcd] [-a CYCLES] [-i CYCLES] [-b CYCLES] [-c] [-l CYCLES]
+ *           [-y BUSLOG] [-p PPM] [-f FRAMES]
+ *
+ * 时间单位为指令周期 (Fosc/4). Timer1 就是周期计数, 所以 display() 里按 Timer1
+ * 等待的点亮, 消隐和稳定时间是准确的. 端口和 Timer1 的每次访问计 -a 个周期 (默认 2),
+ * 每次进出中断计 SIM_ISR_CYCLES, 主循环每圈计 -i 个周期 (默认 8). 用
+ * -fsanitize-coverage=trace-pc 编译时, 固件 C 代码每执行一个基本块计 -b 个周期
+ * (默认 4, 约为 XC8 免费版的代码密度), memcpy/memset/memmove 每字节计
+ * SIM_BYTE_CYCLES, 中断可以在任意两个基本块之间打断主循环; 这样 show_cycles,
+ * fast_cycles 等固件自己用 Timer1 量出的耗时在主机上也有意义. 不加这个选项时
+ * C 代码不计时间. 用 -O0 编译, 优化后 gcc 会把回调当作不改全局变量的函数.
+ * 固件的配置照常用 -D 给出, 如 -DCUBE_SIZE=4 -DRENDER_DEPTH=0
+ * -D_XTAL_FREQ=4000000; 换主频后刷新率和动画进度应当不变, 由同目录的 clockcheck.sh 检查.
+ *
+ * -c 在运行结束后另外量几段固件代码本身的耗时 (期间不响应中断), 如每帧合成
+ * 1..SURFACE_NUM 层, 每种过渡每拍, 闪存帧直接扫描与拷贝后合成, 以及 playlist 每一项
+ * show 每拍的周期数; 需要上面的 trace-pc 计时.
+ *
+ * -f 不做扫描仿真, 而是用固件的 play_sym_anim/draw_sym_frame 把 sym_anim_t 动画按播放顺序
+ * 逐帧画出, 每个动画输出前 FRAMES 帧 (0 为播放一遍) 到标准输出, 格式与 cubec -d 相同,
+ * 每帧的画帧周期数和闪存占用写到 stderr. 默认是 main.c 自带的动画; 用 cubec 生成的头文件
+ * 代替时编译加上 -I. -DCUBEC_HEADER='"anims.h"'. 同目录的 framecheck.sh 用它核对 tools/scenes
+ * 里的场景, cubec 生成的表和 main.c 自带的表三者画出的帧相同.
+ *
+ * -y 用于 -DSYNC_ROLE=1/2 的多块同步: 主机把 I2C 总线上的起始, 字节, 停止和自己 0 层
+ * 点亮的时刻写进 BUSLOG, 从机读入同一个文件按时刻收包, 报告自己 0 层点亮与主机相差
+ * 多少微秒; -p 给本机晶振加上偏差. "-" 为标准输出/输入, 可以直接用管道相连:
+ *   scansim-master -y - | scansim-slave -y - -p 50
+ *
+ * -l 给每次渲染 (render_frame 或一步快节拍效果) 加上若干周期的合成负载, 用来看动画
+ * 变重时刷新率能否守住 SCAN_MIN_REFRESH, 以及每秒实际渲染了多少帧. 用队列时负载
+ * 在主循环里, 期间照常响应中断; 不用队列时渲染在 timer0 中断里, 负载会推迟扫描.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 仿真器自身不插桩, 只有固件代码按基本块计时 */
+#define SIM_FN __attribute__((no_sanitize_coverage))
+
+SIM_FN static void sim_copy(size_t n);
+#define memcpy(d, s, n) (sim_copy(n), memcpy(d, s, n))
+#define memmove(d, s, n) (sim_copy(n), memmove(d, s, n))
+#define memset(d, c, n) (sim_copy(n), memset(d, c, n))
+
+#define main fw_main
+#include "../../main.c"
+#undef main
+
+#define SIM_FOSC _XTAL_FREQ
+#define SIM_ISR_CYCLES 10
+#define SIM_BYTE_CYCLES 6 /* FSR 间接寻址的拷贝循环, 每字节 */
+#define SIM_NS(c) ((c) * 4000000000ULL / SIM_FOSC)
+
+typedef struct {
+    uint64_t sum;
+    uint32_t n, min, max;
+} stat_t;
+
+static uint64_t sim_clock;  /* 已执行的指令周期 */
+static uint64_t sim_at;     /* 最近一次端口访问的时刻, 写入的值从这时起生效 */
+static uint64_t next_t0, next_t2, ccp_prev;
+static unsigned sfr_cycles = 2, idle_cycles = 8, block_cycles = 4;
+static int cost_report;
+static uint64_t sim_blocks, copy_bytes;
+static uint32_t load_cycles, renders, flash_renders;
+static uint8_t fast_seen_steps;
+static int in_isr;
+
+static FILE *vcd;
+static uint64_t vcd_last = ~0ULL;
+static uint8_t last_a, last_c;
+
+static stat_t on_stat[CUBE_SIZE], shift_stat, blank_stat;
+static uint64_t on_start, off_at, shift_start, shcp_last;
+static uint8_t on_layer, off_valid, shift_valid;
+/* 换层开销 (周期): CCP1 匹配到移完一层, 关 OE 比 scan_end 晚多少, 换层时关 OE 到开 OE */
+static stat_t wake_stat, late_stat, switch_stat;
+static uint64_t ccp_at, end_at;
+static uint8_t ccp_valid, end_valid;
+static uint32_t shcp_count, bad_shift, latch_lit, switch_lit;
+
+/* I2C 同步: 主机把总线事件和 0 层点亮的时刻 (ns, 按标称主频) 写成日志, 每行
+ * "时刻 S|B xx|P|L"; 从机读入日志, 到时刻就把字节交给 sync_isr(), 并把自己 0 层
+ * 点亮的时刻与主机最近的一次相比, 得到两块之间实际的扫描偏差. */
+static double ppm; /* 本机晶振偏差, 只影响与总线日志对时 */
+#if SYNC_ROLE != sync_none
+typedef struct {
+    double t;
+    char kind;
+    uint8_t val;
+} bus_ev_t;
+
+static FILE *bus_file;
+static const char *bus_name;
+static bus_ev_t *bus_ev;
+static double *lead_on;
+static size_t bus_n, bus_next, lead_n, lead_next;
+static uint64_t ssp_due; /* 主机: 当前总线操作完成, 置 SSPIF 的周期 */
+static uint8_t ssp_touched, addr_next, bus_synced;
+static uint32_t bus_bytes;
+static stat_t skew_stat; /* ns */
+#endif
+
+SIM_FN static void stat_add(stat_t *s, uint64_t v)
+{
+    if (s->n == 0 || v < s->min)
+        s->min = v;
+    if (v > s->max)
+        s->max = v;
+    s->sum += v;
+    ++s->n;
+}
+
+SIM_FN static void vcd_bits(uint8_t v, int width, char id)
+{
+    int i;
+
+    fputc('b', vcd);
+    for (i = width - 1; i >= 0; --i)
+        fputc((v >> i) & 1 ? '1' : '0', vcd);
+    fprintf(vcd, " %c\n", id);
+}
+
+/* 本机周期数换算成总线日志用的时刻 */
+SIM_FN static double bus_ns(uint64_t c)
+{
+    return c * 4e9 / SIM_FOSC / (1 + ppm * 1e-6);
+}
+
+/* 0 层开始点亮: 主机记入日志, 从机与主机最近的一次比较 */
+SIM_FN static void bus_lead(uint64_t t)
+{
+#if SYNC_ROLE == sync_master
+    if (bus_file)
+        fprintf(bus_file, "%.0f L\n", bus_ns(t));
+#elif SYNC_ROLE == sync_slave
+    double now = bus_ns(t), d;
+
+    if (!bus_synced || lead_n == 0)
+        return;
+    while (lead_next + 1 < lead_n && lead_on[lead_next + 1] <= now)
+        ++lead_next;
+    d = now > lead_on[lead_next] ? now - lead_on[lead_next] : lead_on[lead_next] - now;
+    if (lead_next + 1 < lead_n && lead_on[lead_next + 1] - now < d)
+        d = lead_on[lead_next + 1] - now;
+    stat_add(&skew_stat, (uint64_t)d);
+#else
+    (void)t;
+#endif
+}
+
+/* 根据 PORTC 的变化更新统计; 时刻 t 为写入发生的周期 */
+SIM_FN static void edge(uint8_t old, uint8_t now, uint64_t t)
+{
+    uint8_t rise = ~old & now, fall = old & ~now;
+
+    if (fall & 0b00000100) /* OE 打开 */
+    {
+        on_start = t;
+        on_layer = (now & LAYER_MASK) >> 4;
+        if (on_layer == 0)
+            bus_lead(t);
+        if (off_valid)
+            stat_add(&blank_stat, t - off_at);
+        if (end_valid)
+            stat_add(&switch_stat, t - end_at);
+        end_valid = 0;
+    }
+    if (rise & 0b00000100) /* OE 关闭 */
+    {
+        if (on_layer < CUBE_SIZE && on_start)
+            stat_add(&on_stat[on_layer], t - on_start);
+        off_at = t;
+        off_valid = 1;
+        if ((int16_t)((uint16_t)t - scan_end) >= 0) /* 本层结束, 不是调暗提前关 */
+        {
+            stat_add(&late_stat, (uint16_t)((uint16_t)t - scan_end));
+            end_at = t;
+            end_valid = 1;
+        }
+    }
+    if (!(now & 0b00000100))
+    {
+        if ((old ^ now) & LAYER_MASK)
+            ++switch_lit; /* 点亮时换层, 会把上一层的数据带到新一层 */
+        if (rise & 0b00000010)
+            ++latch_lit;  /* 点亮时锁存, 本层会短暂显示下一层的数据 */
+    }
+    if (fall & 0b00000010)
+    {
+        shift_start = t;
+        shcp_count = 0;
+        shift_valid = 1;
+    }
+    if (rise & 0b00000001)
+    {
+        shcp_last = t;
+        if (++shcp_count == LAYER_SIZE && ccp_valid)
+        {
+            stat_add(&wake_stat, t - ccp_at);
+            ccp_valid = 0;
+        }
+    }
+    if ((rise & 0b00000010) && shift_valid)
+    {
+        stat_add(&shift_stat, shcp_last - shift_start);
+        if (shcp_count != LAYER_SIZE)
+            ++bad_shift;
+        shift_valid = 0;
+    }
+}
+
+/* 把上一次访问写入的值记到 VCD 里 */
+SIM_FN static void sim_commit(void)
+{
+    uint8_t a = sim_porta, c = sim_latc.byte;
+
+    if (a == last_a && c == last_c)
+        return;
+    if (sim_at != vcd_last)
+    {
+        fprintf(vcd, "#%llu\n", (unsigned long long)SIM_NS(sim_at));
+        vcd_last = sim_at;
+    }
+    if (a != last_a)
+        vcd_bits(a, 8, '!');
+    if ((c ^ last_c) & 0b00000001)
+        fprintf(vcd, "%d\"\n", c & 1);
+    if ((c ^ last_c) & 0b00000010)
+        fprintf(vcd, "%d#\n", (c >> 1) & 1);
+    if ((c ^ last_c) & 0b00000100)
+        fprintf(vcd, "%d$\n", (c >> 2) & 1);
+    if ((c ^ last_c) & LAYER_MASK)
+        vcd_bits((c & LAYER_MASK) >> 4, LAYER_BITS, '%');
+    edge(last_c, c, sim_at);
+    last_a = a;
+    last_c = c;
+}
+
+#if SYNC_ROLE != sync_none
+/* MSSP: 主机按 SSPADD 的波特率完成起始, 字节 (含应答) 和停止; 从机按日志收字节 */
+SIM_FN static void sim_i2c(void)
+{
+#if SYNC_ROLE == sync_master
+    uint64_t bit = SSPADD + 1; /* Fosc/(4*(SSPADD+1)) */
+
+    if (ssp_due && sim_clock >= ssp_due)
+    {
+        ssp_due = 0;
+        SSPIF = 1;
+    }
+    if (ssp_due)
+        return;
+    if (SEN)
+    {
+        SEN = 0;
+        ssp_due = sim_clock + bit;
+        if (bus_file)
+            fprintf(bus_file, "%.0f S\n", bus_ns(sim_clock));
+    }
+    else if (PEN)
+    {
+        PEN = 0;
+        ssp_due = sim_clock + bit;
+        if (bus_file)
+            fprintf(bus_file, "%.0f P\n", bus_ns(sim_clock));
+    }
+    else if (ssp_touched)
+    {
+        ssp_touched = 0;
+        ACKSTAT = 0; /* 总有从机应答 */
+        ssp_due = sim_clock + 9 * bit;
+        ++bus_bytes;
+        if (bus_file)
+            fprintf(bus_file, "%.0f B %02x\n", bus_ns(ssp_due), sim_sspbuf); /* 从机收完时才有 SSPIF */
+    }
+#else
+    const bus_ev_t *e;
+
+    while (bus_next < bus_n && bus_ns(sim_clock) >= bus_ev[bus_next].t)
+    {
+        e = &bus_ev[bus_next++];
+        if (e->kind == 'S')
+            addr_next = 1;
+        else if (e->kind == 'P')
+            bus_synced = 1;
+        else
+        {
+            if (SSPIF)
+                SSPOV = 1; /* 上一个字节还没读走 */
+            D_nA = !addr_next;
+            addr_next = 0;
+            sim_sspbuf = e->val;
+            SSPIF = 1;
+            ++bus_bytes;
+        }
+    }
+#endif
+}
+
+/* 从机读入主机写的总线日志 */
+SIM_FN static int bus_load(FILE *f)
+{
+    char line[64], kind;
+    double t;
+    unsigned val;
+    size_t bus_max = 0, lead_max = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        val = 0;
+        if (sscanf(line, "%lf %c %x", &t, &kind, &val) < 2)
+            return -1;
+        if (kind == 'L')
+        {
+            if (lead_n == lead_max && !(lead_on = realloc(lead_on, (lead_max = lead_max * 2 + 256) * sizeof(*lead_on))))
+                return -1;
+            lead_on[lead_n++] = t;
+        }
+        else
+        {
+            if (bus_n == bus_max && !(bus_ev = realloc(bus_ev, (bus_max = bus_max * 2 + 256) * sizeof(*bus_ev))))
+                return -1;
+            bus_ev[bus_n].t = t;
+            bus_ev[bus_n].kind = kind;
+            bus_ev[bus_n++].val = (uint8_t)val;
+        }
+    }
+    return 0;
+}
+#endif
+
+/* 固件每执行一步快节拍效果, 把它自己量出的 fast_cycles 记到该效果名下 */
+static const struct {
+    const fast_fx_t *fx;
+    const char *name;
+    stat_t cycles;
+} fast_names[] = {
+    {&fast_rain, "fx_rain_step"}, {&fast_starfield, "fx_star_step"}, {&fast_sparkle, "fx_sparkle_step"},
+#if BAR_ENABLE
+    {&fast_bars, "fx_bars_step"},
+#endif
+};
+static stat_t fast_stat[sizeof(fast_names) / sizeof(fast_names[0])];
+
+SIM_FN static void sim_fast(void)
+{
+    size_t i;
+
+    if (fast_steps == fast_seen_steps)
+        return;
+    fast_seen_steps = fast_steps;
+    for (i = 0; i < sizeof(fast_names) / sizeof(fast_names[0]); ++i)
+        if (fast_names[i].fx == fast_fx)
+            stat_add(&fast_stat[i], fast_cycles);
+}
+
+/* 按当前周期置位到期的中断标志, 允许时调用 isr() */
+SIM_FN static void sim_irq(void)
+{
+    uint64_t delta;
+    uint16_t ccpr;
+#if !RENDER_DEPTH
+    unsigned pos;
+#endif
+
+    while (sim_clock >= next_t0)
+    {
+        TMR0IF = 1; /* Fosc/4, 1:256 预分频, 256 计数溢出 */
+        next_t0 += 65536;
+    }
+    while (sim_clock >= next_t2)
+    {
+        TMR2IF = 1; /* 预分频 1/4/16/64, 计到 PR2, 再按 T2OUTPS 后分频 */
+        next_t2 += (1u << 2 * (T2CON & 0b00000011)) * (PR2 + 1) * (((T2CON >> 3) & 0b00001111) + 1);
+    }
+    if (CCP1CON == 0b00001010) /* 比较模式: TMR1 在 (ccp_prev, sim_clock] 内经过 CCPR1 */
+    {
+        ccpr = ((uint16_t)CCPR1H << 8) | CCPR1L;
+        delta = sim_clock - ccp_prev;
+        if (delta >= 65536 || ((uint16_t)(ccpr - ccp_prev) != 0 && (uint16_t)(ccpr - ccp_prev) <= delta))
+        {
+            CCP1IF = 1;
+            ccp_at = sim_clock - (uint16_t)((uint16_t)sim_clock - ccpr);
+            ccp_valid = 1;
+        }
+    }
+    ccp_prev = sim_clock;
+#if SYNC_ROLE != sync_none
+    sim_i2c();
+#endif
+
+    /* 标志总会置位, 中断里或 GIE 关闭时只是推迟到能响应的时候 */
+    if (in_isr || !GIE)
+        return;
+    if ((TMR0IE && TMR0IF) || (PEIE && ((TMR2IE && TMR2IF) || (CCP1IE && CCP1IF) || (RCIE && RCIF) || (SSPIE && SSPIF))))
+    {
+        in_isr = 1;
+        sim_clock += SIM_ISR_CYCLES;
+#if !RENDER_DEPTH
+        pos = play_idx << 8 | play_tick;
+        isr();
+        if ((play_idx << 8 | play_tick) != pos) /* timer0 在中断里渲染了一帧 */
+        {
+            ++renders;
+            flash_renders += frame_src != display_buffer;
+            sim_clock += load_cycles;
+        }
+#else
+        isr();
+#endif
+        sim_fast();
+        sim_commit();
+        in_isr = 0;
+    }
+}
+
+SIM_FN static void sim_access(void)
+{
+    sim_commit();
+    sim_irq();
+    sim_at = sim_clock;
+    sim_clock += sfr_cycles;
+}
+
+SIM_FN static void sim_idle(unsigned cycles)
+{
+    sim_commit();
+    sim_irq();
+    sim_clock += cycles;
+}
+
+/* 较长的一段耗时 (合成负载, 内存拷贝), 分小段执行, 中断照常在段间响应 */
+SIM_FN static void sim_load(uint32_t cycles)
+{
+    while (cycles > 16)
+    {
+        sim_idle(16);
+        cycles -= 16;
+    }
+    sim_idle(cycles);
+}
+
+SIM_FN static void sim_copy(size_t n)
+{
+    copy_bytes += n;
+    sim_load(n * SIM_BYTE_CYCLES);
+}
+
+/* -fsanitize-coverage=trace-pc 在固件的每个基本块前调用 */
+SIM_FN void __sanitizer_cov_trace_pc(void)
+{
+    ++sim_blocks;
+    sim_idle(block_cycles);
+}
+
+SIM_FN volatile uint8_t *sim_reg(uint8_t *reg)
+{
+    sim_access();
+    return reg;
+}
+
+SIM_FN sim_rc_t *sim_portc_bits(void)
+{
+    sim_access();
+    return &sim_latc.bits;
+}
+
+SIM_FN uint8_t sim_tmr1(uint8_t high)
+{
+    sim_access();
+    return high ? (uint8_t)(sim_clock >> 8) : (uint8_t)sim_clock;
+}
+
+SIM_FN volatile uint8_t *sim_ssp(void)
+{
+    sim_access();
+#if SYNC_ROLE != sync_none
+    ssp_touched = 1; /* 主机只写 SSPBUF, 下一次 sim_irq 时已写入 */
+#endif
+    return &sim_sspbuf;
+}
+
+/* 不让中断插进来, 量一次调用本身的周期数 */
+SIM_FN static uint32_t sim_cost(void (*fn)(void))
+{
+    uint64_t t = sim_clock;
+
+    in_isr = 1;
+    fn();
+    in_isr = 0;
+    return (uint32_t)(sim_clock - t);
+}
+
+SIM_FN static void cost_line(const char *name, uint32_t cycles)
+{
+    fprintf(stderr, "  %-26s %8lu cycles %8.1f us\n", name, (unsigned long)cycles, SIM_NS(cycles) / 1000.0);
+}
+
+/* 每帧合成的开销: 所有行都改过, 上层用 blend_xor, 不在过渡中 */
+SIM_FN static void cost_compose(void)
+{
+#if COMPOSE_ENABLE
+    char name[32];
+    uint8_t n;
+
+    fprintf(stderr, "compose_display, all %d rows dirty:\n", ROW_NUM);
+    trans_type = trans_cut;
+    for (n = 1; n <= SURFACE_NUM; ++n)
+    {
+        surface_used = n;
+        (memset)(surface_blend, blend_xor, SURFACE_NUM);
+        (memset)(dirty_rows, 0b11111111, sizeof(dirty_rows));
+        sprintf(name, "%u surface%s", n, n > 1 ? "s" : "");
+        cost_line(name, sim_cost(compose_display));
+    }
+#else
+    fprintf(stderr, "compose_display: COMPOSE_ENABLE is 0\n");
+#endif
+}
+
+#if COMPOSE_ENABLE
+static uint8_t bench_trans;
+
+SIM_FN static void bench_start(void)
+{
+    start_transition(bench_trans);
+}
+
+SIM_FN static void bench_tick(void)
+{
+    step_transition();
+    compose_display();
+}
+#endif
+
+/* 过渡每拍的开销 (step_transition + 合成), 与 trans_cut 下整帧合成相比 */
+SIM_FN static void cost_transitions(void)
+{
+#if COMPOSE_ENABLE
+    static const char *const names[] = {"cut", "wipe_x", "wipe_y", "wipe_z", "dissolve"};
+    uint32_t start, c, sum, max;
+    uint8_t i;
+
+    fprintf(stderr, "transition, 1 surface (start / avg tick / max tick):\n");
+    frame_src = display_buffer;
+    surface_used = 1;
+    for (bench_trans = trans_cut; bench_trans <= trans_dissolve; ++bench_trans)
+    {
+        (memset)(dirty_rows, 0b11111111, sizeof(dirty_rows));
+        start = sim_cost(bench_start);
+        sum = max = 0;
+        for (i = 0; i < TRANS_TICKS; ++i)
+        {
+            if (bench_trans == trans_cut)
+                (memset)(dirty_rows, 0b11111111, sizeof(dirty_rows));
+            sum += c = sim_cost(bench_tick);
+            if (c > max)
+                max = c;
+        }
+        fprintf(stderr, "  %-10s %6lu %8lu %8lu cycles %8.1f us max\n", names[bench_trans],
+                (unsigned long)start, (unsigned long)(sum / TRANS_TICKS),
+                (unsigned long)max, SIM_NS(max) / 1000.0);
+    }
+    trans_type = trans_cut;
+#endif
+}
+
+/* 固件全局变量占用的 RAM, 与 main.c 里各模块的 RAM_* 估计对照; 指针在 PIC 上占 2 字节 */
+#define RAM_VAR(v) (sizeof(v))
+#define RAM_PTRS(v) (sizeof(v) / sizeof(void *) * 2)
+
+SIM_FN static void ram_line(const char *name, unsigned long vars, unsigned long budget, unsigned long *sum)
+{
+    fprintf(stderr, "  %-8s %6lu %6lu\n", name, vars, budget);
+    *sum += vars;
+}
+
+SIM_FN static void ram_report(void)
+{
+    unsigned long sum = 0;
+
+    fprintf(stderr, "RAM        vars  RAM_*\n");
+#if COMPOSE_ENABLE
+    ram_line("compose", RAM_VAR(display_buffer) + RAM_VAR(surface) + RAM_VAR(surface_blend) + RAM_VAR(surface_used) +
+             RAM_VAR(dirty_rows) + RAM_VAR(compose_rows) + RAM_VAR(trans_type) + RAM_VAR(trans_step) +
+             RAM_VAR(trans_from) + RAM_VAR(trans_mask) + RAM_VAR(trans_lfsr), RAM_COMPOSE, &sum);
+#else
+    ram_line("compose", RAM_VAR(display_buffer), RAM_COMPOSE, &sum);
+#endif
+#if RENDER_DEPTH
+    ram_line("render", RAM_VAR(render_buf) + RAM_PTRS(render_ring) + RAM_VAR(render_fast) + RAM_PTRS(frame_src) +
+             RAM_VAR(render_head) + RAM_VAR(render_tail) + RAM_VAR(render_live) + RAM_VAR(render_clock) +
+             RAM_VAR(fast_clock) + RAM_VAR(render_seen) + RAM_VAR(fast_seen) + RAM_VAR(render_wait) +
+             RAM_VAR(render_fill) + RAM_VAR(render_underrun) + RAM_VAR(render_cycles), RAM_RENDER, &sum);
+#endif
+#if SYNC_ROLE != sync_none
+    ram_line("sync", RAM_VAR(sync_pkt) + RAM_VAR(sync_pos) + RAM_VAR(sync_state) + RAM_VAR(sync_overrun) +
+             RAM_VAR(sync_nack) + RAM_VAR(sync_skew) + RAM_VAR(sync_skew_max) + RAM_VAR(sync_resync) + RAM_VAR(sync_next) + RAM_VAR(sync_at) + RAM_VAR(sync_hold) +
+             RAM_VAR(sync_bad), RAM_SYNC, &sum);
+#endif
+#if BAR_ENABLE
+#if RENDER_DEPTH
+    ram_line("bar", RAM_VAR(bar_rx) + RAM_VAR(bar_rx_pos) + RAM_VAR(bar_rx_mode) + RAM_VAR(bar_target) +
+             RAM_VAR(bar_cur) + RAM_VAR(bar_mode) + RAM_VAR(bar_ready) + RAM_VAR(bar_hold) + RAM_VAR(bar_packets) +
+             RAM_VAR(bar_flush), RAM_BAR, &sum);
+#else
+    ram_line("bar", RAM_VAR(bar_rx) + RAM_VAR(bar_rx_pos) + RAM_VAR(bar_rx_mode) + RAM_VAR(bar_target) +
+             RAM_VAR(bar_cur) + RAM_VAR(bar_mode) + RAM_VAR(bar_ready) + RAM_VAR(bar_hold) + RAM_VAR(bar_packets),
+             RAM_BAR, &sum);
+#endif
+#endif
+#if PREVIEW_ENABLE
+    ram_line("preview", RAM_VAR(preview_last) + RAM_VAR(preview_state) + RAM_VAR(preview_pos) + RAM_VAR(preview_val) +
+             RAM_VAR(preview_sum) + RAM_VAR(preview_seq) + RAM_VAR(preview_key) + RAM_VAR(preview_due) +
+             RAM_VAR(preview_packets), RAM_PREVIEW, &sum);
+#endif
+#if BTN_ENABLE
+    ram_line("button", RAM_VAR(btn_queue) + RAM_VAR(btn_head) + RAM_VAR(btn_tail) + RAM_VAR(btn_state) +
+             RAM_VAR(btn_debounce) + RAM_VAR(btn_dropped), RAM_BTN, &sum);
+#endif
+    /* 各 show 的 static 状态在函数里, 这里只数全局的部分 */
+    ram_line("state", RAM_VAR(layer_idx) + RAM_VAR(scan_slot) + RAM_PTRS(draw_buffer) + RAM_PTRS(scan_src) +
+             RAM_PTRS(flash_frame) + RAM_VAR(tmr0_post) + RAM_VAR(play_idx) + RAM_VAR(play_tick) + RAM_VAR(show_start) +
+             RAM_VAR(show_cycles) + RAM_VAR(fast_cycles) + RAM_VAR(fast_steps) + RAM_VAR(isr_cycles) + RAM_PTRS(fast_fx) + RAM_VAR(fast_kick) +
+             RAM_VAR(fx_rand_state) + RAM_VAR(show_over_budget) + RAM_VAR(scan_on_start) + RAM_VAR(scan_on_sum) +
+             RAM_VAR(scan_due) + RAM_VAR(scan_end) + RAM_VAR(scan_blank_sum) + RAM_VAR(scan_on_frame) +
+             RAM_VAR(scan_blank_frame) +
+#if SCAN_ADAPT
+             RAM_VAR(scan_period) +
+#endif
+             RAM_VAR(scan_bright) + RAM_VAR(scan_lit_open) + RAM_VAR(play_paused), RAM_STATE, &sum);
+    fprintf(stderr, "  %-8s %6lu %6lu of %d (RAM_USED, 1024 less RAM_STACK)\n", "total", sum,
+            (unsigned long)RAM_USED, 1024 - RAM_STACK);
+}
+
+#if COMPOSE_ENABLE && CUBE_SIZE == 8
+SIM_FN static void bench_flash(void)
+{
+    select_surface(0);
+    flash_frame = 0;
+    op_cell_rotate();
+    present_frame();
+}
+
+/* 同一帧先拷进合成层再整帧合成, 即没有闪存直接扫描时的做法 */
+SIM_FN static void bench_flash_copy(void)
+{
+    select_surface(0);
+    flash_frame = 0;
+    op_cell_rotate();
+    memcpy(draw_buffer, flash_frame, BUF_SIZE);
+    (memset)(dirty_rows, 0b11111111, sizeof(dirty_rows));
+    compose_display();
+}
+#endif
+
+/* op_cell_rotate 一拍: 直接扫描闪存帧与拷贝后合成相比 */
+SIM_FN static void cost_flash(void)
+{
+#if COMPOSE_ENABLE && CUBE_SIZE == 8
+    uint64_t bytes = copy_bytes;
+    uint32_t c;
+
+    fprintf(stderr, "op_cell_rotate tick:\n");
+    trans_type = trans_cut;
+    frame_src = display_buffer;
+    cost_line("scan from flash", sim_cost(bench_flash));
+    c = sim_cost(bench_flash_copy);
+    cost_line("copy and compose", c);
+    fprintf(stderr, "  (%llu bytes copied, %d rows composed; %u frames, %u bytes, stay in flash)\n",
+            (unsigned long long)(copy_bytes - bytes), ROW_NUM, anim_cell_rotate.frames,
+            anim_cell_rotate.frames * BUF_SIZE);
+#endif
+}
+
+/* playlist 里 show 的名字, 只用于报告 */
+#define SIM_SHOW(f) {f, #f}
+static const struct {
+    void (*show)();
+    const char *name;
+} show_names[] = {
+#if CUBE_SIZE == 8
+    SIM_SHOW(op_cell_start), SIM_SHOW(op_cell_end), SIM_SHOW(op_cell_rotate), SIM_SHOW(trans_display_heart),
+    SIM_SHOW(trans_display_circle), SIM_SHOW(trans_display_love), SIM_SHOW(trans_display_love_wave),
+    SIM_SHOW(op_beat),
+#else
+    SIM_SHOW(op_shell),
+#endif
+    SIM_SHOW(fx_wave), SIM_SHOW(fx_ripple), SIM_SHOW(fx_plasma), SIM_SHOW(fx_rain), SIM_SHOW(fx_starfield),
+    SIM_SHOW(fx_sparkle),
+};
+
+SIM_FN static const char *show_name(void (*show)())
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(show_names) / sizeof(show_names[0]); ++i)
+        if (show_names[i].show == show)
+            return show_names[i].name;
+    return "?";
+}
+
+SIM_FN static void bench_show(void)
+{
+    select_surface(0);
+    flash_frame = 0;
+    fast_fx = 0;
+    playlist[play_idx].show();
+}
+
+/* playlist 每一项在它的全部节拍里 show 本身的周期数, 与 budget 对照 */
+SIM_FN static void cost_shows(void)
+{
+    uint32_t c, sum, max;
+
+    fprintf(stderr, "show per tick (avg / max / budget, cycles):\n");
+    for (play_idx = 0; play_idx < PLAY_NUM; ++play_idx)
+    {
+        sum = max = 0;
+        for (play_tick = 0; play_tick < playlist[play_idx].ticks; ++play_tick)
+        {
+            sum += c = sim_cost(bench_show);
+            if (c > max)
+                max = c;
+        }
+        fprintf(stderr, "  %2u %-24s %7lu %7lu %7u%s\n", play_idx, show_name(playlist[play_idx].show),
+                (unsigned long)(sum / playlist[play_idx].ticks), (unsigned long)max, playlist[play_idx].budget,
+                playlist[play_idx].budget && max > playlist[play_idx].budget ? "  over" : "");
+    }
+}
+
+#if CUBE_SIZE == 8
+/* -f: 用固件自己的 play_sym_anim/draw_sym_frame 播放 sym_anim_t 动画 */
+static const sym_anim_t *dump_anim;
+static uint8_t dump_frame, dump_tick;
+static const uint8_t *dump_shared[16]; /* 已计过闪存的 data, 共用同一份帧的动画只计 sym_anim_t */
+static unsigned dump_flash, dump_raw;
+
+SIM_FN static void bench_sym(void)
+{
+    play_sym_anim(dump_anim, &dump_frame, &dump_tick);
+}
+
+/*
+ * 按播放顺序输出前 n 帧 (0 为播放一遍), 每行是 display_buffer 的十六进制, 名字, 帧号和持续的
+ * timer0 次数, 与 cubec -d 的格式相同; 画帧那一拍的周期数和闪存占用写到 stderr.
+ */
+SIM_FN static void dump_sym(const char *name, const sym_anim_t *anim, unsigned n)
+{
+    uint32_t c, sum = 0, max = 0;
+    unsigned i, k, hold, size, flash;
+
+    size = ((anim->sym & SYM_Y) ? 4 : 8) * ((anim->sym & SYM_Z) ? 4 : 8);
+    if (anim->sym & SYM_X)
+        size >>= 1;
+    flash = anim->frames * (size + 1);
+    for (i = 0; i < 16 && dump_shared[i] && dump_shared[i] != anim->data; ++i)
+        ;
+    if (i < 16 && dump_shared[i])
+        flash = 0;
+    else if (i < 16)
+        dump_shared[i] = anim->data;
+    flash += 6;
+    dump_flash += flash;
+    dump_raw += anim->frames * BUF_SIZE;
+    if (n == 0)
+        n = anim->frames;
+    draw_buffer = display_buffer;
+    dump_anim = anim;
+    show_start = 1;
+    for (i = 0; i < n; ++i)
+    {
+        sum += c = sim_cost(bench_sym); /* dump_tick 为 0, 这一拍画新帧 */
+        if (c > max)
+            max = c;
+        show_start = 0;
+        for (k = 0; k < BUF_SIZE; ++k)
+            printf("%02x", display_buffer[k]);
+        for (hold = 1; dump_tick; ++hold)
+            sim_cost(bench_sym);
+        printf(" %s %u %u\n", name, i, hold);
+    }
+    fprintf(stderr, "  %-16s %6u %c%c%c%c %6u %6u", name, anim->frames, anim->sym & SYM_X ? 'x' : '-',
+            anim->sym & SYM_Y ? 'y' : '-', anim->sym & SYM_Z ? 'z' : '-', anim->sym & SYM_REVERSE ? 'r' : '-',
+            flash, anim->frames * BUF_SIZE);
+    if (sim_blocks)
+        fprintf(stderr, " %7lu %7lu\n", (unsigned long)(sum / n), (unsigned long)max);
+    else
+        fprintf(stderr, " %7s %7s\n", "-", "-");
+}
+
+/* 给了 -DCUBEC_HEADER 时换成 cubec 生成的表; 放在函数里, 与 main.c 里同名的表互不冲突 */
+SIM_FN static void dump_anims(unsigned n)
+{
+#ifdef CUBEC_HEADER
+#include CUBEC_HEADER
+#define CUBEC_ANIM(name) dump_sym(#name, &anim_##name, n);
+#endif
+    /* 闪存 = 数据 + hold + sym_anim_t, raw 为整帧存储; 周期为画新帧那一拍 play_sym_anim 的耗时 */
+    fprintf(stderr, "sym anim (frames / sym / flash / raw bytes, avg / max cycles):\n");
+#ifdef CUBEC_HEADER
+    CUBEC_ANIMS
+#else
+    dump_sym("heart", &anim_heart, n);
+    dump_sym("circle", &anim_circle, n);
+    dump_sym("cell_start", &anim_cell_start, n);
+    dump_sym("cell_end", &anim_cell_end, n);
+#endif
+    fprintf(stderr, "  %-16s %6s %4s %6u %6u\n", "total", "", "", dump_flash, dump_raw);
+    if (!sim_blocks)
+        fprintf(stderr, "cycles need a -fsanitize-coverage=trace-pc build\n");
+}
+#endif
+
+SIM_FN static void report(const char *name, const stat_t *s)
+{
+    if (s->n == 0)
+    {
+        fprintf(stderr, "%-8s %8s\n", name, "-");
+        return;
+    }
+    fprintf(stderr, "%-8s %8u %10.1f %10.1f %10.1f\n", name, s->n,
+            SIM_NS(s->min) / 1000.0, SIM_NS(s->sum) / 1000.0 / s->n, SIM_NS(s->max) / 1000.0);
+}
+
+SIM_FN int main(int argc, char **argv)
+{
+    const char *out_name = "scan.vcd";
+    double ms = 200;
+    uint64_t end, on_sum = 0;
+#if RENDER_DEPTH
+    uint8_t tail;
+#endif
+    char name[16];
+    int i, frames = -1;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            ms = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_name = argv[++i];
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+            sfr_cycles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            idle_cycles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            block_cycles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))
+            cost_report = 1;
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            load_cycles = atol(argv[++i]);
+#if SYNC_ROLE != sync_none
+        else if (!strcmp(argv[i], "-y") && i + 1 < argc)
+            bus_name = argv[++i];
+#endif
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            ppm = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || ms <= 0)
+    {
+        fprintf(stderr, "usage: scansim [-t MS] [-o scan.vcd] [-a CYCLES] [-i CYCLES] [-b CYCLES] [-c] [-l CYCLES]"
+                        " [-y BUSLOG] [-p PPM] [-f FRAMES]\n");
+        return 2;
+    }
+    if (frames >= 0)
+    {
+#if CUBE_SIZE == 8
+        dump_anims(frames);
+        return 0;
+#else
+        fprintf(stderr, "-f needs CUBE_SIZE 8\n");
+        return 2;
+#endif
+    }
+#if SYNC_ROLE == sync_master
+    if (bus_name && !(bus_file = strcmp(bus_name, "-") ? fopen(bus_name, "w") : stdout))
+    {
+        perror(bus_name);
+        return 1;
+    }
+#elif SYNC_ROLE == sync_slave
+    if (bus_name)
+    {
+        if (!(bus_file = strcmp(bus_name, "-") ? fopen(bus_name, "r") : stdin))
+        {
+            perror(bus_name);
+            return 1;
+        }
+        if (bus_load(bus_file))
+        {
+            fprintf(stderr, "%s: bad bus log\n", bus_name);
+            return 1;
+        }
+        fclose(bus_file);
+    }
+#endif
+    if (!(vcd = fopen(out_name, "w")))
+    {
+        perror(out_name);
+        return 1;
+    }
+
+    fprintf(vcd, "$version scansim CUBE_SIZE=%d RENDER_DEPTH=%d $end\n", CUBE_SIZE, RENDER_DEPTH);
+    fprintf(vcd, "$timescale 1ns $end\n$scope module cube $end\n");
+    fprintf(vcd, "$var wire 8 ! data $end\n$var wire 1 \" shcp $end\n$var wire 1 # stcp $end\n");
+    fprintf(vcd, "$var wire 1 $ oe $end\n$var wire %d %% layer $end\n", LAYER_BITS);
+    fprintf(vcd, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+    vcd_bits(0, 8, '!');
+    fprintf(vcd, "0\"\n0#\n0$\n");
+    vcd_bits(0, LAYER_BITS, '%');
+    fprintf(vcd, "$end\n");
+    vcd_last = 0;
+
+    end = (uint64_t)(ms * (SIM_FOSC / 4) / 1000);
+    next_t0 = 65536;
+    system_init();
+    TXIF = 1; /* 发送寄存器总是空的 */
+    while (sim_clock < end)
+    {
+#if RENDER_DEPTH
+        tail = render_tail;
+        render_ahead();
+        sim_fast();
+        if (render_tail != tail) /* 放入或直接换上了一帧 */
+        {
+            ++renders;
+            flash_renders += frame_src != display_buffer;
+            sim_load(load_cycles);
+        }
+#if PREVIEW_ENABLE
+        preview_poll();
+#endif
+#else
+        display();
+#endif
+        sim_idle(idle_cycles);
+    }
+    sim_commit();
+    fclose(vcd);
+#if SYNC_ROLE == sync_master
+    if (bus_file && bus_file != stdout)
+        fclose(bus_file);
+#endif
+
+    fprintf(stderr, "%.1f ms at %lu Hz, %llu cycles -> %s\n", ms, (unsigned long)SIM_FOSC,
+            (unsigned long long)sim_clock, out_name);
+    if (sim_blocks)
+        fprintf(stderr, "C code %llu blocks x %u cycles, copies %llu bytes\n",
+                (unsigned long long)sim_blocks, block_cycles, (unsigned long long)copy_bytes);
+    else
+        fprintf(stderr, "C code not timed, build with -fsanitize-coverage=trace-pc\n");
+    fprintf(stderr, "%-8s %8s %10s %10s %10s  (us)\n", "", "count", "min", "avg", "max");
+    for (i = 0; i < CUBE_SIZE; ++i)
+    {
+        sprintf(name, "layer %d", i);
+        report(name, &on_stat[i]);
+        on_sum += on_stat[i].sum;
+    }
+    report("shift", &shift_stat);
+    report("blank", &blank_stat);
+    if (on_sum + blank_stat.sum)
+        fprintf(stderr, "duty %.1f%%, refresh %.1f Hz\n", 100.0 * on_sum / (on_sum + blank_stat.sum),
+                on_stat[0].n * 1000.0 / ms);
+    fprintf(stderr, "latch while lit %u, layer switch while lit %u, short shifts %u\n",
+            latch_lit, switch_lit, bad_shift);
+    /* 与 main.c 里按指令周期给出的换层开销对照 */
+    if (shift_stat.n)
+        fprintf(stderr, "shift %.1f cycles/byte (SCAN_BYTE_CYCLES %d)", (double)shift_stat.sum / shift_stat.n / LAYER_SIZE,
+                SCAN_BYTE_CYCLES);
+    if (wake_stat.n)
+        fprintf(stderr, ", ccp1 to shifted avg %.1f max %u cycles (SCAN_SHIFT_CYCLES %d)",
+                (double)wake_stat.sum / wake_stat.n, wake_stat.max, SCAN_SHIFT_CYCLES);
+    if (switch_stat.n)
+        fprintf(stderr, ", layer end to open max %u cycles (SCAN_GAP_CYCLES %d)", switch_stat.max, SCAN_GAP_CYCLES);
+    fprintf(stderr, "\n");
+    if (late_stat.n)
+        fprintf(stderr, "layer end after scan_end: avg %.1f max %u cycles\n", (double)late_stat.sum / late_stat.n,
+                late_stat.max);
+    fprintf(stderr, "playlist item %u, tick %u, show over budget %u times\n", play_idx, play_tick, show_over_budget);
+    for (i = 0; i < (int)(sizeof(fast_names) / sizeof(fast_names[0])); ++i)
+        if (fast_stat[i].n)
+            fprintf(stderr, "%-16s %6u steps, fast_cycles avg %lu max %lu (%.1f us)\n", fast_names[i].name,
+                    fast_stat[i].n, (unsigned long)(fast_stat[i].sum / fast_stat[i].n), (unsigned long)fast_stat[i].max,
+                    SIM_NS(fast_stat[i].max) / 1000.0);
+    fprintf(stderr, "rendered %u frames (%.1f/s), load %lu cycles each (%.1f%% of cpu)",
+            renders, renders * 1000.0 / ms, (unsigned long)load_cycles,
+            100.0 * renders * load_cycles / sim_clock);
+#if RENDER_DEPTH
+    fprintf(stderr, ", underruns %u", render_underrun);
+#endif
+    fprintf(stderr, "\n");
+    /* 闪存帧省去 show 写合成层 (或 display_buffer), 合成, 以及放入队列时的拷贝 */
+    fprintf(stderr, "scanned %u frames straight from flash, %lu bytes of RAM writes avoided\n", flash_renders,
+            (unsigned long)flash_renders * BUF_SIZE * (1 + COMPOSE_ENABLE + (RENDER_DEPTH > 0)));
+#if SCAN_ADAPT
+    fprintf(stderr, "scan period now %.1f us (%.1f..%.1f)\n", SIM_NS(scan_period) / 1000.0,
+            SIM_NS(SCAN_PERIOD_MIN) / 1000.0, SIM_NS(SCAN_PERIOD_MAX) / 1000.0);
+#endif
+#if SYNC_ROLE == sync_master
+    fprintf(stderr, "sync master: %u bytes sent, overrun %u, nack %u\n", bus_bytes, sync_overrun, sync_nack);
+#elif SYNC_ROLE == sync_slave
+    fprintf(stderr, "sync slave: %u bytes received, resync %u, bad packets %u, sync_skew %+d, max %u slots\n",
+            bus_bytes, sync_resync, sync_bad, sync_skew, sync_skew_max);
+    if (skew_stat.n)
+        fprintf(stderr, "layer 0 on vs master (%+.0f ppm): %u frames, avg %.1f us, max %.1f us\n", ppm,
+                skew_stat.n, skew_stat.sum / 1000.0 / skew_stat.n, skew_stat.max / 1000.0);
+#endif
+    ram_report();
+    if (cost_report && sim_blocks)
+    {
+        cost_compose();
+        cost_transitions();
+        cost_flash();
+        cost_shows();
+    }
+    else if (cost_report)
+        fprintf(stderr, "-c needs a -fsanitize-coverage=trace-pc build\n");
+    return 0;
+}
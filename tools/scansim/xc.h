@@ -0,0 +1,47 @@
+/*
+ * scansim 使用的 xc.h 替身, 让 main.c 在主机上编译.
+ *
+ * PORTA/LATA, PORTC/LATC/PORTCbits 和 TMR1L/TMR1H 的每次访问都经过 sim_access():
+ * 推进指令周期计数, 记录引脚变化, 到时间就调用 isr(). SSPBUF 经过 sim_ssp(),
+ * 主机写入后由 scansim.c 按 I2C 波特率安排发送完成的 SSPIF.
+ * 其余寄存器和中断标志只是普通变量, 由 scansim.c 按需要读写.
+ */
+#ifndef SCANSIM_XC_H
+#define SCANSIM_XC_H
+
+#include <stdint.h>
+
+#define interrupt
+
+typedef struct { unsigned RC0:1, RC1:1, RC2:1, RC3:1, RC4:1, RC5:1, RC6:1, RC7:1; } sim_rc_t;
+typedef union { uint8_t byte; sim_rc_t bits; } sim_portc_t;
+
+uint8_t sim_porta;
+sim_portc_t sim_latc;
+uint8_t sim_sspbuf;
+
+volatile uint8_t *sim_reg(uint8_t *reg);
+sim_rc_t *sim_portc_bits(void);
+uint8_t sim_tmr1(uint8_t high);
+volatile uint8_t *sim_ssp(void);
+
+#define PORTA (*sim_reg(&sim_porta))
+#define LATA PORTA
+#define PORTC (*sim_reg(&sim_latc.byte))
+#define LATC PORTC
+#define PORTCbits (*sim_portc_bits())
+#define TMR1L sim_tmr1(0)
+#define TMR1H sim_tmr1(1)
+#define SSPBUF (*sim_ssp())
+
+volatile uint8_t PORTB, LATB, TRISA, TRISB, TRISC, ANSELA, ANSELB, WPUB;
+volatile uint8_t OSCCON, OSCSTAT, TMR0, T1CON, TMR2, PR2, T2CON, CCP1CON, CCPR1L, CCPR1H;
+volatile uint8_t RCREG, TXREG, SPBRG, SPBRGH, APFCON, IOCBP, IOCBN, IOCBF;
+volatile uint8_t SSPADD, SSPMSK, SSPCON1, SSPCON2, SSPCON3, SSPSTAT;
+volatile unsigned GIE, PEIE, TMR0IE, TMR0IF, TMR2IE, TMR2IF, CCP1IE, CCP1IF, IOCIE, IOCIF;
+volatile unsigned nWPUEN, TMR0CS, PSA, PS2, PS1, PS0, SPLLEN, PLLR = 1;
+volatile unsigned RCIE, RCIF, TXIE, TXIF, SPEN, CREN, TXEN, SYNC, BRGH, BRG16, OERR, TXSEL, RXSEL;
+volatile unsigned SSPIE, SSPIF, SSPEN, SSPOV, BCLIF, SEN, PEN, RSEN, RCEN, ACKEN, ACKDT, ACKSTAT;
+volatile unsigned GCEN, D_nA, R_nW, BF, CKP, SCKSEL, SDISEL;
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * voximport - 体素模型/切片图导入工具 (主机端)
+ *
+ * 把 MagicaVoxel .vox, 8 层切片图 (PGM/PBM) 或 display_buffer 原始转储
+ * 转成 main.c 里 play_packed_anim() 使用的 packed_anim_t 表:
+ * 相同的帧只保存一次, 每帧只保存非全暗的行.
+ *
+ *   cc -O2 -o voximport tools/voximport.c
+ *   voximport [-n NAME] [-h TICKS] [-t THRESHOLD] [-o out.h] FILE...
+ *
+ * 输入按文件扩展名区分, 每个文件可以贡献多帧, 按命令行顺序播放:
+ *   .vox      每个模型一帧, 任意尺寸按比例缩到 8x8x8 (不足 8 格的轴按最近的格子放大),
+ *             MagicaVoxel 的 z 轴朝上对应层号
+ *   .pgm .pbm 一帧, 8 个切片从左到右横向排列 (z=0 在最左), 每个切片按面积平均后取阈值
+ *   其他      display_buffer 原始转储, 每 64 字节一帧, 低电平为亮
+ *
+ * -t 为缩小时一个格子里被占据的比例 (0..1), 超过才点亮, 默认 0.5. 选项可以写在文件之间,
+ * 一律先读完再载入文件, 对所有文件有效; 16 位的 PGM (maxval > 255 的 P5) 不支持
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#define CUBE 8
+#define FRAME_SIZE (CUBE * CUBE)
+#define MAX_FRAMES 255
+
+static uint8_t frame[MAX_FRAMES][FRAME_SIZE]; /* 行号 z*8+y, 位 x, 1 为亮 */
+static int frame_num;
+static double threshold = 0.5;
+
+static uint8_t *new_frame(const char *name)
+{
+    if (frame_num >= MAX_FRAMES)
+    {
+        fprintf(stderr, "%s: more than %d frames\n", name, MAX_FRAMES);
+        exit(1);
+    }
+    memset(frame[frame_num], 0, FRAME_SIZE);
+    return frame[frame_num++];
+}
+
+static uint8_t *read_file(const char *name, long *size)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *buf;
+
+    if (!f)
+    {
+        perror(name);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size ? *size : 1);
+    if (!buf || fread(buf, 1, *size, f) != (size_t)*size)
+    {
+        fprintf(stderr, "%s: read error\n", name);
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* 目标格 c 在长度为 s 的源轴上对应 [lo, hi); 源轴不足 8 格时取最近的一格, 不留空格 */
+static void src_span(int c, int s, int *lo, int *hi)
+{
+    *lo = c * s / CUBE;
+    *hi = (c + 1) * s / CUBE;
+    if (*hi <= *lo)
+        *hi = *lo + 1;
+}
+
+/* 把 sx*sy*sz 的占据计数缩放到 8x8x8, 一格内占据比例超过阈值即点亮 */
+static void downsample(const char *name, const uint8_t *occ, int sx, int sy, int sz)
+{
+    uint8_t *f = new_frame(name);
+    int x, y, z, x0, x1, y0, y1, z0, z1, i, j, k;
+    unsigned hit, cells;
+
+    for (z = 0; z < CUBE; ++z)
+    {
+        src_span(z, sz, &z0, &z1);
+        for (y = 0; y < CUBE; ++y)
+        {
+            src_span(y, sy, &y0, &y1);
+            for (x = 0; x < CUBE; ++x)
+            {
+                src_span(x, sx, &x0, &x1);
+                hit = cells = 0;
+                for (k = z0; k < z1; ++k)
+                    for (j = y0; j < y1; ++j)
+                        for (i = x0; i < x1; ++i)
+                        {
+                            ++cells;
+                            hit += occ[((long)k * sy + j) * sx + i];
+                        }
+                if (hit > threshold * cells)
+                    f[z * CUBE + y] |= (uint8_t)(1 << x);
+            }
+        }
+    }
+}
+
+static void load_vox(const char *name)
+{
+    long size, pos;
+    uint8_t *buf = read_file(name, &size);
+    int sx = 0, sy = 0, sz = 0;
+
+    if (size < 20 || memcmp(buf, "VOX ", 4) || memcmp(buf + 8, "MAIN", 4))
+    {
+        fprintf(stderr, "%s: not a MagicaVoxel file\n", name);
+        exit(1);
+    }
+    /* MAIN 的子块: [PACK] (SIZE XYZI)*, 其余块忽略 */
+    for (pos = 20; pos + 12 <= size;)
+    {
+        const uint8_t *chunk = buf + pos;
+        uint32_t len = le32(chunk + 4), child = le32(chunk + 8);
+        const uint8_t *body = chunk + 12;
+
+        if (pos + 12 + (long)len + (long)child > size)
+            break;
+        if (!memcmp(chunk, "SIZE", 4) && len >= 12)
+        {
+            sx = (int)le32(body);
+            sy = (int)le32(body + 4);
+            sz = (int)le32(body + 8);
+        }
+        else if (!memcmp(chunk, "XYZI", 4) && len >= 4 && sx > 0 && sy > 0 && sz > 0)
+        {
+            uint32_t n = le32(body), i;
+            uint8_t *occ = calloc((size_t)sx * sy * sz, 1);
+            for (i = 0; i < n && 4 + i * 4 + 4 <= len; ++i)
+            {
+                const uint8_t *v = body + 4 + i * 4;
+                if (v[0] < sx && v[1] < sy && v[2] < sz)
+                    occ[((long)v[2] * sy + v[1]) * sx + v[0]] = 1;
+            }
+            downsample(name, occ, sx, sy, sz);
+            free(occ);
+        }
+        pos += 12 + len + child;
+    }
+    free(buf);
+}
+
+/* 读一个十进制数; one_digit 时只读一位, P1 的像素之间可以没有空白 */
+static int pnm_token(const uint8_t *buf, long size, long *pos, int one_digit)
+{
+    int v = 0;
+
+    for (;;)
+    {
+        while (*pos < size && isspace(buf[*pos]))
+            ++*pos;
+        if (*pos < size && buf[*pos] == '#')
+        {
+            while (*pos < size && buf[*pos] != '\n')
+                ++*pos;
+            continue;
+        }
+        break;
+    }
+    while (*pos < size && isdigit(buf[*pos]))
+    {
+        v = v * 10 + (buf[(*pos)++] - '0');
+        if (one_digit)
+            break;
+    }
+    return v;
+}
+
+/* P1/P4 (PBM, 1 为黑) 与 P2/P5 (PGM), 黑色或深色视为点亮 */
+static void load_pnm(const char *name)
+{
+    long size, pos = 2, i;
+    uint8_t *buf = read_file(name, &size);
+    int kind, w, h, maxval = 1, x, y, z;
+    uint8_t *occ;
+
+    if (size < 3 || buf[0] != 'P' || !strchr("1245", buf[1]))
+    {
+        fprintf(stderr, "%s: only PBM/PGM slice images are supported\n", name);
+        exit(1);
+    }
+    kind = buf[1] - '0';
+    w = pnm_token(buf, size, &pos, 0);
+    h = pnm_token(buf, size, &pos, 0);
+    if (kind == 2 || kind == 5)
+        maxval = pnm_token(buf, size, &pos, 0);
+    if (maxval > 255 && kind == 5)
+    {
+        fprintf(stderr, "%s: 16-bit PGM (maxval %d) is not supported, save with maxval 255\n", name, maxval);
+        exit(1);
+    }
+    if (w < CUBE || w % CUBE || h <= 0 || maxval <= 0)
+    {
+        fprintf(stderr, "%s: width must be a multiple of 8 (8 slices side by side)\n", name);
+        exit(1);
+    }
+    ++pos;
+
+    /* 切片宽 w/8, 高 h: 图像 x -> 体素 x, 图像从下往上 -> 体素 y */
+    occ = calloc((size_t)w * h, 1);
+    for (i = 0; i < (long)w * h; ++i)
+    {
+        int v = 0;
+        if (kind == 1 || kind == 2)
+            v = pnm_token(buf, size, &pos, kind == 1);
+        else if (kind == 4)
+        {
+            long row = i / w, col = i % w, off = pos + row * ((w + 7) / 8) + col / 8;
+            v = off < size ? (buf[off] >> (7 - col % 8)) & 1 : 0;
+        }
+        else if (pos + i < size)
+            v = buf[pos + i];
+        if (kind == 1 || kind == 4)
+            occ[i] = (uint8_t)v;
+        else
+            occ[i] = v * 2 < maxval;
+    }
+
+    {
+        int sw = w / CUBE;
+        uint8_t *vol = calloc((size_t)sw * h * CUBE, 1);
+        for (z = 0; z < CUBE; ++z)
+            for (y = 0; y < h; ++y)
+                for (x = 0; x < sw; ++x)
+                    vol[((long)z * h + y) * sw + x] = occ[(long)(h - 1 - y) * w + z * sw + x];
+        downsample(name, vol, sw, h, CUBE);
+        free(vol);
+    }
+    free(occ);
+    free(buf);
+}
+
+static void load_raw(const char *name)
+{
+    long size, off;
+    uint8_t *buf = read_file(name, &size);
+    int i;
+
+    if (size == 0 || size % FRAME_SIZE)
+    {
+        fprintf(stderr, "%s: raw dump must be a multiple of %d bytes\n", name, FRAME_SIZE);
+        exit(1);
+    }
+    for (off = 0; off < size; off += FRAME_SIZE)
+    {
+        uint8_t *f = new_frame(name);
+        for (i = 0; i < FRAME_SIZE; ++i)
+            f[i] = (uint8_t)~buf[off + i];
+    }
+    free(buf);
+}
+
+static const char *ext(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot ? dot + 1 : "";
+}
+
+/* 行掩码 8 字节 + 非全暗的行, 数据按 display_buffer 的低电平为亮保存 */
+static int pack(const uint8_t *lit, uint8_t *out)
+{
+    int z, y, n = CUBE;
+
+    for (z = 0; z < CUBE; ++z)
+    {
+        out[z] = 0;
+        for (y = 0; y < CUBE; ++y)
+            if (lit[z * CUBE + y])
+            {
+                out[z] |= (uint8_t)(1 << y);
+                out[n++] = (uint8_t)~lit[z * CUBE + y];
+            }
+    }
+    return n;
+}
+
+static void emit_bytes(FILE *out, const uint8_t *p, int n)
+{
+    int i, b;
+
+    for (i = 0; i < n; ++i)
+    {
+        fprintf(out, "%s0b", (i % 8) ? " " : "    ");
+        for (b = 7; b >= 0; --b)
+            fputc('0' + ((p[i] >> b) & 1), out);
+        fputc(',', out);
+        if (i % 8 == 7 || i == n - 1)
+            fputc('\n', out);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = "asset", *out_name = NULL;
+    const char **in_name = calloc(argc, sizeof(*in_name));
+    int hold = 2, i, j, uniq_num = 0, data_len = 0, in_num = 0;
+    static int seq[MAX_FRAMES], uniq[MAX_FRAMES], offset[MAX_FRAMES];
+    static uint8_t data[MAX_FRAMES * (FRAME_SIZE + CUBE)];
+    FILE *out = stdout;
+
+    /* 先读完选项再载入文件, -t 对写在它前面的文件同样有效 */
+    for (i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            name = argv[++i];
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            hold = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_name = argv[++i];
+        else if (argv[i][0] == '-')
+            break;
+        else
+            in_name[in_num++] = argv[i];
+    }
+    if (i < argc || in_num == 0 || hold < 1 || hold > 255)
+    {
+        fprintf(stderr, "usage: voximport [-n NAME] [-h TICKS] [-t THRESHOLD] [-o out.h] FILE...\n");
+        return 2;
+    }
+    for (i = 0; i < in_num; ++i)
+    {
+        if (!strcmp(ext(in_name[i]), "vox"))
+            load_vox(in_name[i]);
+        else if (!strcmp(ext(in_name[i]), "pgm") || !strcmp(ext(in_name[i]), "pbm"))
+            load_pnm(in_name[i]);
+        else
+            load_raw(in_name[i]);
+    }
+    if (frame_num == 0)
+    {
+        fprintf(stderr, "%s: no frames\n", in_name[0]);
+        return 1;
+    }
+
+    for (i = 0; i < frame_num; ++i)
+    {
+        for (j = 0; j < uniq_num; ++j)
+            if (!memcmp(frame[uniq[j]], frame[i], FRAME_SIZE))
+                break;
+        if (j == uniq_num)
+        {
+            uniq[uniq_num] = i;
+            offset[uniq_num] = data_len;
+            data_len += pack(frame[i], data + data_len);
+            ++uniq_num;
+        }
+        seq[i] = j;
+    }
+
+    if (out_name && !(out = fopen(out_name, "w")))
+    {
+        perror(out_name);
+        return 1;
+    }
+    fprintf(out, "/* generated by voximport from %s%s, do not edit */\n\n", in_name[0], in_num > 1 ? " ..." : "");
+    fprintf(out, "const uint8_t %s_seq[] = {", name);
+    for (i = 0; i < frame_num; ++i)
+        fprintf(out, "%s%d", i ? ", " : "", seq[i]);
+    fprintf(out, "};\nconst uint8_t %s_hold[] = {", name);
+    for (i = 0; i < frame_num; ++i)
+        fprintf(out, "%s%d", i ? ", " : "", hold);
+    fprintf(out, "};\nconst uint16_t %s_offset[] = {", name);
+    for (i = 0; i < uniq_num; ++i)
+        fprintf(out, "%s%d", i ? ", " : "", offset[i]);
+    fprintf(out, "};\nconst uint8_t %s_data[] = {\n", name);
+    emit_bytes(out, data, data_len);
+    fprintf(out, "};\nconst packed_anim_t anim_%s = {%d, %s_seq, %s_hold, %s_offset, %s_data};\n",
+            name, frame_num, name, name, name, name);
+    if (out_name)
+        fclose(out);
+
+    fprintf(stderr, "%s: %d frames, %d unique\n", name, frame_num, uniq_num);
+    fprintf(stderr, "  raw                %6d bytes\n", frame_num * FRAME_SIZE);
+    fprintf(stderr, "  deduplicated       %6d bytes\n", uniq_num * FRAME_SIZE + frame_num);
+    fprintf(stderr, "  dedup + row packing %5d bytes (incl. seq, hold, offsets)\n",
+            data_len + frame_num * 2 + uniq_num * 2);
+    return 0;
+}